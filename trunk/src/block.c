@@ -4,322 +4,799 @@
 #include <sysexits.h>
 #include <assert.h>
 #include <stdio.h>
+#include <pthread.h>
 
 #include "block.h"
 #include "tsp.h"
+#include "context.h"
+
+#if defined(__GNUC__) && defined(__x86_64__)
+#define HAVE_X86_KERNELS
+#include <immintrin.h>
+#endif
+
+/* The vector kernels which bin the cities only compute Morton keys. */
+#if defined(HAVE_X86_KERNELS) && CELL_SIDE == 2
+#define HAVE_MORTON_KERNELS
+#endif
+
+/*
+ * The kernels which rotate the cities, and which bin the rotated cities on
+ * the finest grid. The fastest version supported by the processor is chosen 
+ * at run time. They are two passes over the cities: the cells depend on the
+ * limits of the rotated plane, which are only known once every city is 
+ * rotated. The vector bin kernels compute Morton keys, so with a CELL_SIDE
+ * other than 2 the cities are always binned by bin_scalar().
+ */
+static void (*_rotate_kernel) (Context * ctx, int first, int last,
+                               double cos_rot, double sin_rot,
+                               double *limits) = NULL;
+static void (*_bin_kernel) (Context * ctx, int first, int last,
+                            double x_step, double y_step) = NULL;
+/* The kernels are chosen once, by the first context which needs them. */
+static pthread_once_t _kernels_once = PTHREAD_ONCE_INIT;
+
+static void rotate(Context * ctx);
+static void select_kernels(void);
+static void rotate_scalar(Context * ctx, int first, int last,
+                          double cos_rot, double sin_rot, double *limits);
+static void bin_scalar(Context * ctx, int first, int last, double x_step,
+                       double y_step);
+#ifdef HAVE_X86_KERNELS
+static void rotate_avx2(Context * ctx, int first, int last, double cos_rot,
+                        double sin_rot, double *limits);
+static void rotate_avx512(Context * ctx, int first, int last,
+                          double cos_rot, double sin_rot, double *limits);
+#endif
+#ifdef HAVE_MORTON_KERNELS
+static void bin_avx2(Context * ctx, int first, int last, double x_step,
+                     double y_step);
+static void bin_avx512(Context * ctx, int first, int last, double x_step,
+                       double y_step);
+#endif
+static void sort_keys(Workspace * ws);
+static int resort_keys(Workspace * ws);
+static uint64_t cell_key(uint32_t x, uint32_t y);
+static unsigned int common_levels(uint64_t a, uint64_t b,
+                                  const uint64_t *scales);
+static uint64_t mix_bits(uint64_t v);
+static unsigned int placed_level(const Workspace * ws, int i, int leaf,
+                                 const uint64_t *scales);
+static double crossing_step(double u, double du);
+#if CELL_SIDE == 2
+static uint64_t spread_bits(uint32_t v);
+static uint32_t compact_bits(uint64_t v);
+#endif
 
-double extern rotation = 0;
-
-/* This contains all the cached values. */
-static double _rotation = FP_NAN;
-static double _x_max;
-static double _x_min;
-static double _y_max;
-static double _y_min;
-static City *_rot_cities = NULL;
-static unsigned int _num_cities;
-
-static void check_limits(void);
-static void rotate(void);
-
-grd    *
-create_grd(const unsigned int *length, const unsigned int *height)
+void
+sort_cities(Context * ctx)
 {
-   /*
-    * Update the cache containing the rotated cities if necessary. 
-    */
-   rotate();
-
-   /*
-    * Create a new grid and initialize all the values. 
-    */
-   grd    *new_grd;
-   int    *indices;
-   int     filled_blocks = 0;
-
-   if ((new_grd = calloc(1, sizeof(grd))) == NULL)
-      errx(EX_OSERR, "Not enough memory!");
-
-   new_grd->length = *length;
-   new_grd->height = *height;
+   rotate(ctx);
+}
 
-   /*
-    * Search how many blocks will have to be made. 
-    */
-   if ((indices = calloc(*length * *height, sizeof(int))) == NULL)
-      errx(EX_OSERR, "Not enough memory!");
+void
+split_cell(const Context * ctx, unsigned int level, int lo, int hi,
+           int *bounds)
+{
+   const Workspace *ws = ctx->ws;
 
-   for (int i = 0; i < (*length * *height); i++)
-      indices[i] = INIT_INDEX;
+   assert(level > 0 && level <= MAX_LEVEL);
+   assert(lo < hi && hi <= ws->num_cities);
 
    /*
-    * Compute the necessary values which will be used to index the cities. 
+    * All the keys in the range share the cell at the previous level, so the
+    * subcell of a key is found in the digit after the prefix. The first key
+    * of subcell sub is base + sub * scale.
     */
-   double  x_step = fabs(_x_min - _x_max) / (double) (*length);
-   double  y_step = fabs(_y_min - _y_max) / (double) (*height);
-
-   for (int i = 0; i < _num_cities; i++) {
-      unsigned int x = rint(floor((_rot_cities[i].x - _x_min) / x_step));
-      unsigned int y = rint(floor((_rot_cities[i].y - _y_min) / y_step));
+   uint64_t scale = key_scale(level);
+#if CELL_SIDE == 2
+   uint64_t base = ws->keys[lo] & ~(scale * SUBCELLS - 1);
+#else
+   uint64_t base = ws->keys[lo] / (scale * SUBCELLS) * (scale * SUBCELLS);
+#endif
+
+   bounds[0] = lo;
+   for (int sub = 1; sub < SUBCELLS; sub++) {
       /*
-       * Search if the block is already counted for. 
+       * Binary search for the first key in a later subcell. 
        */
-      int     j = 0;
-      for (j = 0; j < (*length * *height); j++)
-         if (indices[j] == ((x * *height) + y))
-            break;
-         else if (indices[j] == INIT_INDEX)
-            break;
-
-      if (indices[j] == INIT_INDEX) {
-         /*
-          * One more block will have to be allocated. 
-          */
-         filled_blocks++;
-         indices[j] = ((x * *height) + y);
-      }
-   }
+      uint64_t bound = base + sub * scale;
+      int     first = bounds[sub - 1];
+      int     last = hi;
 
-   /*
-    * There should be one more box in the array. 
-    */
-   filled_blocks++;
-   new_grd->filled_blocks = filled_blocks;
-
-   if ((new_grd->block_cty = calloc(filled_blocks, sizeof(int))) == NULL)
-      errx(EX_OSERR, "Not enough memory!");
-   if ((new_grd->block_idx = calloc(filled_blocks, sizeof(int))) == NULL)
-      errx(EX_OSERR, "Not enough memory!");
-
-   for (int i = 0; i < filled_blocks; i++)
-      new_grd->block_idx[i] = INIT_INDEX;
+      while (first < last) {
+         int     mid = first + (last - first) / 2;
 
-   for (int i = 0; i < _num_cities; i++) {
-      unsigned int x = rint(floor((_rot_cities[i].x - _x_min) / x_step));
-      unsigned int y = rint(floor((_rot_cities[i].y - _y_min) / y_step));
-      /*
-       * Search if the block has already an entry. 
-       */
-      int     j = 0;
-      for (j = 0; j < filled_blocks; j++)
-         if (new_grd->block_idx[j] == ((x * *height) + y)) {
-            break;
-         } else if (new_grd->block_idx[j] == INIT_INDEX) {
-            break;
-         }
-
-      if (new_grd->block_idx[j] == INIT_INDEX) {
-         /*
-          * The index has to be stored. 
-          */
-         new_grd->block_idx[j] = ((x * *height) + y);
-         new_grd->block_cty[j] = i;
-      } else if (new_grd->block_idx[j] >= 0) {
-         assert(new_grd->block_idx[j] == ((x * *height) + y));
-         new_grd->block_cty[j] = MANY_CITIES;
+         if (ws->keys[mid] < bound)
+            first = mid + 1;
+         else
+            last = mid;
       }
+      bounds[sub] = first;
    }
-
-   return new_grd;
+   bounds[SUBCELLS] = hi;
 }
 
 int
-has_city(grd * grid, int x, int y)
+sorted_city(const Context * ctx, int i)
 {
-   assert(grid != NULL);
-   assert(x < grid->height);
-   assert(y < grid->length);
-
-   for (int i = 0; i < grid->filled_blocks; i++)
-      if (grid->block_idx[i] == ((x * grid->height) + y))
-         return grid->block_cty[i];
+   assert(i >= 0 && i < ctx->ws->num_cities);
 
-   return NO_CITY;
+   return ctx->ws->order[i];
 }
 
 void
-print_cities(FILE * f)
+key_cell(uint64_t key, unsigned int level, unsigned int *x, unsigned int *y)
 {
-   assert(f != NULL);
-   (void) fprintf(f, "city_x city_y\n");
-   for (int i = 0; i < _num_cities; i++)
-      (void) fprintf(f, "%lf %lf\n", _rot_cities[i].x, _rot_cities[i].y);
+   uint64_t cell = key / key_scale(level);
+
+#if CELL_SIDE == 2
+   *x = compact_bits(cell);
+   *y = compact_bits(cell >> 1);
+#else
+   unsigned int digit = 1;
+
+   *x = 0;
+   *y = 0;
+   for (unsigned int l = 0; l < level; l++) {
+      *x += (cell % CELL_SIDE) * digit;
+      *y += (cell / CELL_SIDE % CELL_SIDE) * digit;
+      cell /= SUBCELLS;
+      digit *= CELL_SIDE;
+   }
+#endif
 }
 
-void
-free_grd(grd * grid)
+uint64_t
+grid_signature(const Context * ctx, int leaf)
 {
-   assert(grid != NULL);
+   const Workspace *ws = ctx->ws;
+   int     n = ws->num_cities;
+   uint64_t scales[MAX_LEVEL + 1];
+   uint64_t sign = 0;
 
-   free(grid->block_cty);
-   free(grid->block_idx);
+   if (leaf < 1)
+      leaf = 1;
+   for (unsigned int l = 0; l <= MAX_LEVEL; l++)
+      scales[l] = key_scale(l);
 
-   free(grid);
-   grid = NULL;
+   /*
+    * The terms are added, so the order of the cities within a cell does not
+    * matter.
+    */
+   for (int i = 0; i < n; i++) {
+      unsigned int level = placed_level(ws, i, leaf, scales);
+
+      sign += mix_bits(mix_bits(ws->keys[i] / scales[level] * 
+                                (MAX_LEVEL + 1) + level) ^ ws->order[i]);
+   }
+   return sign;
 }
 
-static void
-rotate(void)
+double
+rotation_step(const Context * ctx, int leaf)
 {
-   /*
-    * It the old rotation is the same nothing has to be done. 
-    */
-   if (_rot_cities != NULL && _rotation == rotation)
-      return;
+   const Workspace *ws = ctx->ws;
+   int     n = ws->num_cities;
+   uint64_t scales[MAX_LEVEL + 1];
+   double  sides[MAX_LEVEL + 1];
+   int     x_lo = 0, x_hi = 0, y_lo = 0, y_hi = 0;
+   double  step = INFINITY;
+
+   if (leaf < 1)
+      leaf = 1;
+   for (unsigned int l = 0; l <= MAX_LEVEL; l++) {
+      scales[l] = key_scale(l);
+      sides[l] = pow(CELL_SIDE, l);
+   }
 
    /*
-    * Free and allocate memory for the cities in the rotated plane. 
+    * The limits of the plane follow the cities at its borders. A rotated 
+    * city moves at a rate of (y, -x).
     */
-   if (_rot_cities != NULL)
-      free(_rot_cities);
+   for (int c = 1; c < n; c++) {
+      if (ws->rot_x[c] < ws->rot_x[x_lo])
+         x_lo = c;
+      if (ws->rot_x[c] > ws->rot_x[x_hi])
+         x_hi = c;
+      if (ws->rot_y[c] < ws->rot_y[y_lo])
+         y_lo = c;
+      if (ws->rot_y[c] > ws->rot_y[y_hi])
+         y_hi = c;
+   }
 
-   if ((_rot_cities = calloc(tsp->dimension, sizeof(City))) == NULL)
-      errx(EX_OSERR, "No memory left!");
+   double  width = ctx->x_max - ctx->x_min;
+   double  height = ctx->y_max - ctx->y_min;
+   double  d_x_min = ws->rot_y[x_lo];
+   double  d_width = ws->rot_y[x_hi] - ws->rot_y[x_lo];
+   double  d_y_min = -ws->rot_x[y_lo];
+   double  d_height = ws->rot_x[y_lo] - ws->rot_x[y_hi];
 
    /*
-    * Rotate the cities. 
+    * The position of a city in cells at its level is u = cells * (x - x_min)
+    * / width, crossing the border of its cell when u passes an integer.
     */
-   for (int i = 0; i < tsp->dimension; i++) {
-      _rot_cities[i].x = tsp->cities[i].x * cos(rotation) +
-          tsp->cities[i].y * sin(rotation);
-      _rot_cities[i].y = -tsp->cities[i].x * sin(rotation) +
-          tsp->cities[i].y * cos(rotation);
+   for (int i = 0; i < n; i++) {
+      int     c = ws->order[i];
+      double  cells = sides[placed_level(ws, i, leaf, scales)];
+      double  x = ws->rot_x[c] - ctx->x_min;
+      double  y = ws->rot_y[c] - ctx->y_min;
+      double  d_x = ws->rot_y[c] - d_x_min;
+      double  d_y = -ws->rot_x[c] - d_y_min;
+
+      step = fmin(step, crossing_step(cells * x / width, cells *
+                                      (d_x * width - x * d_width) /
+                                      (width * width)));
+      step = fmin(step, crossing_step(cells * y / height, cells *
+                                      (d_y * height - y * d_height) /
+                                      (height * height)));
    }
-   /*
-    * Update the cached cities. 
-    */
-   _rotation = rotation;
-   _num_cities = tsp->dimension;
-
-   check_limits();
+   return step;
 }
 
 void
-print_grd_lines(grd * grid, FILE * f)
+print_cities(const Context * ctx, FILE * f)
 {
-   assert(grid != NULL);
    assert(f != NULL);
+   (void) fprintf(f, "city_x city_y\n");
+   for (int i = 0; i < ctx->ws->num_cities; i++)
+      (void) fprintf(f, "%lf %lf\n", ctx->ws->rot_x[i], ctx->ws->rot_y[i]);
+}
+
+static void
+rotate(Context * ctx)
+{
+   Workspace *ws = ctx->ws;
+
+   /*
+    * It the old rotation is the same nothing has to be done. 
+    */
+   if (ctx->sorted_rotation == ctx->rotation)
+      return;
+
+   pthread_once(&_kernels_once, select_kernels);
+
    /*
-    * Compute the necessary values which will be used to index the cities. 
+    * Rotate the cities and find the limits of the rotated plane. 
     */
-   double  x_step = fabs(_x_min - _x_max) / (double) grid->length;
-   double  y_step = fabs(_y_min - _y_max) / (double) grid->height;
+   double  limits[4] = { INFINITY, -INFINITY, INFINITY, -INFINITY };
+
+   _rotate_kernel(ctx, 0, ws->num_cities, cos(ctx->rotation),
+                  sin(ctx->rotation), limits);
 
    /*
-    * Print the grid. At the end of each line a NA is needed to halt the line.
-    * * See for more information on this the R manual for lines(). 
+    * Built some margin to be sure that all the cities are included in 
+    * * a box. 
     */
+   ctx->x_min = limits[0] - X_MARGIN;
+   ctx->x_max = limits[1] + X_MARGIN;
+   ctx->y_min = limits[2] - Y_MARGIN;
+   ctx->y_max = limits[3] + Y_MARGIN;
+
    /*
-    * The header. 
+    * Index the cities on the finest grid. The steps are an exact power of 
+    * CELL_SIDE fraction of the grid size, so dividing the keys gives the same
+    * cells as indexing on a coarser grid directly.
     */
-   (void) fprintf(f, "x y\n");
+   _bin_kernel(ctx, 0, ws->num_cities,
+               fabs(ctx->x_min - ctx->x_max) / (double) GRID_SIZE,
+               fabs(ctx->y_min - ctx->y_max) / (double) GRID_SIZE);
+
    /*
-    * First the vertical lines. 
+    * After a small rotation the order of the previous rotation is nearly
+    * sorted already. Only the sort follows the previous rotation, the cities
+    * are rotated and binned again in full: the cells are fractions of the 
+    * limits of the rotated plane, which move with every rotation, so the key
+    * of every city may change.
     */
-   for (double x = _x_min; x < _x_max; x += x_step) {
-      (void) fprintf(f, "%lf %lf\n", x, _y_min);
-      (void) fprintf(f, "%lf %lf\n", x, _y_max);
-      (void) fprintf(f, "%lf NA\n");
+   if (isnan(ctx->sorted_rotation) || !resort_keys(ws)) {
+      for (int i = 0; i < ws->num_cities; i++)
+         ws->order[i] = i;
+      sort_keys(ws);
    }
-   (void) fprintf(f, "%lf %lf\n", _x_max, _y_min);
-   (void) fprintf(f, "%lf %lf\n", _x_max, _y_max);
-   (void) fprintf(f, "%lf NA\n");
 
    /*
-    * The horizontal lines. 
+    * Update the cached cities. 
     */
-   for (double y = _y_min; y < _y_max; y += y_step) {
-      (void) fprintf(f, "%lf %lf\n", _x_min, y);
-      (void) fprintf(f, "%lf %lf\n", _x_max, y);
-      (void) fprintf(f, "%lf NA\n");
+   ctx->sorted_rotation = ctx->rotation;
+}
+
+/*
+ * Choose the fastest kernels which are supported by the processor.
+ */
+static void
+select_kernels(void)
+{
+   _rotate_kernel = rotate_scalar;
+   _bin_kernel = bin_scalar;
+
+#ifdef HAVE_X86_KERNELS
+   __builtin_cpu_init();
+   if (__builtin_cpu_supports("avx512f"))
+      _rotate_kernel = rotate_avx512;
+   else if (__builtin_cpu_supports("avx2"))
+      _rotate_kernel = rotate_avx2;
+#endif
+#ifdef HAVE_MORTON_KERNELS
+   if (__builtin_cpu_supports("avx512f"))
+      _bin_kernel = bin_avx512;
+   else if (__builtin_cpu_supports("avx2"))
+      _bin_kernel = bin_avx2;
+#endif
+}
+
+/*
+ * Rotate the cities first up to last and widen limits, which holds the 
+ * minimum and maximum x followed by the minimum and maximum y, to include 
+ * them.
+ */
+static void
+rotate_scalar(Context * ctx, int first, int last, double cos_rot,
+              double sin_rot, double *limits)
+{
+   const Tsp *tsp = ctx->tsp;
+   Workspace *ws = ctx->ws;
+
+   for (int i = first; i < last; i++) {
+      double  x = tsp->x[i] * cos_rot + tsp->y[i] * sin_rot;
+      double  y = -tsp->x[i] * sin_rot + tsp->y[i] * cos_rot;
+
+      ws->rot_x[i] = x;
+      ws->rot_y[i] = y;
+
+      if (x < limits[0])
+         limits[0] = x;
+      if (x > limits[1])
+         limits[1] = x;
+      if (y < limits[2])
+         limits[2] = y;
+      if (y > limits[3])
+         limits[3] = y;
    }
-   (void) fprintf(f, "%lf %lf\n", _x_min, _y_max);
-   (void) fprintf(f, "%lf %lf\n", _x_max, _y_max);
-   (void) fprintf(f, "%lf NA\n");
 }
 
-void
-print_grd_points(grd * grid, FILE * f)
+/*
+ * Compute the keys of the rotated cities first up to last on the finest 
+ * grid, of which the cells measure x_step by y_step. A city on the upper 
+ * border belongs to the last cell.
+ */
+static void
+bin_scalar(Context * ctx, int first, int last, double x_step,
+           double y_step)
 {
-   assert(grid != NULL);
-   assert(f != NULL);
-   /*
-    * Compute the necessary values which will be used to index the cities. 
-    */
-   double  x_step = fabs(_x_min - _x_max) / (double) (grid->length);
-   double  y_step = fabs(_y_min - _y_max) / (double) (grid->height);
+   Workspace *ws = ctx->ws;
+   const double max_cell = (double) (GRID_SIZE - 1);
 
-   /*
-    * Print the header. 
-    */
-   (void) fprintf(f, "x y pch\n");
-
-   for (int x = 0; x < grid->length; x++) {
-      for (int y = 0; y < grid->height; y++) {
-         /*
-          * Print the coordinate of the center of a box. 
-          */
-         (void) fprintf(f, "%lf %lf",
-                        x * x_step + (_x_min + 0.5 * x_step),
-                        y * y_step + (_y_min + 0.5 * y_step));
-         /*
-          * Determine the logo which will represent the center of the box. 
-          * * These numbers are R codes. 
-          */
-         switch (has_city(grid, x, y)) {
-         case NO_CITY:
-            /*
-             * pch=23 is a diamond. 
-             */
-            (void) fprintf(f, " 23\n");
-            break;
-         case MANY_CITIES:
-            /*
-             * pch=24 is a triangle point up. 
-             */
-            (void) fprintf(f, " 24\n");
-            break;
-         default:
-            /*
-             * pch=19 is a solid circle. 
-             */
-            (void) fprintf(f, " 19\n");
-         }
-      }
+   for (int i = first; i < last; i++) {
+      double  x = floor((ws->rot_x[i] - ctx->x_min) / x_step);
+      double  y = floor((ws->rot_y[i] - ctx->y_min) / y_step);
+
+      if (x > max_cell)
+         x = max_cell;
+      if (y > max_cell)
+         y = max_cell;
+
+      ws->keys[i] = cell_key((uint32_t) x, (uint32_t) y);
    }
 }
 
+#ifdef HAVE_X86_KERNELS
+/*
+ * The vector kernels compute exactly the same values as the scalar ones: the
+ * products and sums are rounded in the same order and no fused multiply add
+ * is used. The cell numbers are converted to integers by adding 2^52, after
+ * which they are the low bits of the double.
+ */
+#define INT_MAGIC 4503599627370496.0
+/* The rounding of floor(), it has to be an immediate operand. */
+#define ROUND_DOWN (_MM_FROUND_TO_NEG_INF | _MM_FROUND_NO_EXC)
+
+__attribute__ ((target("avx2")))
 static void
-check_limits(void)
+rotate_avx2(Context * ctx, int first, int last, double cos_rot,
+            double sin_rot, double *limits)
 {
-   if (_rot_cities == NULL)
-      return;
+   const Tsp *tsp = ctx->tsp;
+   Workspace *ws = ctx->ws;
+   const __m256d c = _mm256_set1_pd(cos_rot);
+   const __m256d s = _mm256_set1_pd(sin_rot);
+   __m256d x_min = _mm256_set1_pd(limits[0]);
+   __m256d x_max = _mm256_set1_pd(limits[1]);
+   __m256d y_min = _mm256_set1_pd(limits[2]);
+   __m256d y_max = _mm256_set1_pd(limits[3]);
+   double  lanes[4];
+   int     i;
+
+   for (i = first; i + 4 <= last; i += 4) {
+      __m256d x = _mm256_loadu_pd(tsp->x + i);
+      __m256d y = _mm256_loadu_pd(tsp->y + i);
+      __m256d rot_x = _mm256_add_pd(_mm256_mul_pd(x, c), _mm256_mul_pd(y, s));
+      __m256d rot_y = _mm256_sub_pd(_mm256_mul_pd(y, c), _mm256_mul_pd(x, s));
+
+      _mm256_storeu_pd(ws->rot_x + i, rot_x);
+      _mm256_storeu_pd(ws->rot_y + i, rot_y);
+
+      x_min = _mm256_min_pd(x_min, rot_x);
+      x_max = _mm256_max_pd(x_max, rot_x);
+      y_min = _mm256_min_pd(y_min, rot_y);
+      y_max = _mm256_max_pd(y_max, rot_y);
+   }
 
    /*
-    * Cache the x-max and min and the y-max and min. 
+    * Reduce the lanes, the order does not matter for a minimum or maximum.
     */
-   _x_max = -FP_INFINITE;
-   _x_min = FP_INFINITE;
-   _y_max = -FP_INFINITE;
-   _y_min = FP_INFINITE;
-
-   for (int i = 0; i < _num_cities; i++) {
-      if (_rot_cities[i].x > _x_max)
-         _x_max = _rot_cities[i].x;
-      if (_rot_cities[i].x < _x_min)
-         _x_min = _rot_cities[i].x;
-      if (_rot_cities[i].y > _y_max)
-         _y_max = _rot_cities[i].y;
-      if (_rot_cities[i].y < _y_min)
-         _y_min = _rot_cities[i].y;
+   _mm256_storeu_pd(lanes, x_min);
+   for (int l = 0; l < 4; l++)
+      limits[0] = fmin(limits[0], lanes[l]);
+   _mm256_storeu_pd(lanes, x_max);
+   for (int l = 0; l < 4; l++)
+      limits[1] = fmax(limits[1], lanes[l]);
+   _mm256_storeu_pd(lanes, y_min);
+   for (int l = 0; l < 4; l++)
+      limits[2] = fmin(limits[2], lanes[l]);
+   _mm256_storeu_pd(lanes, y_max);
+   for (int l = 0; l < 4; l++)
+      limits[3] = fmax(limits[3], lanes[l]);
+
+   rotate_scalar(ctx, i, last, cos_rot, sin_rot, limits);
+}
+
+#ifdef HAVE_MORTON_KERNELS
+__attribute__ ((target("avx2")))
+static inline __m256i
+spread_avx2(__m256i x)
+{
+   x = _mm256_and_si256(_mm256_or_si256(x, _mm256_slli_epi64(x, 16)),
+                        _mm256_set1_epi64x(0x0000FFFF0000FFFFULL));
+   x = _mm256_and_si256(_mm256_or_si256(x, _mm256_slli_epi64(x, 8)),
+                        _mm256_set1_epi64x(0x00FF00FF00FF00FFULL));
+   x = _mm256_and_si256(_mm256_or_si256(x, _mm256_slli_epi64(x, 4)),
+                        _mm256_set1_epi64x(0x0F0F0F0F0F0F0F0FULL));
+   x = _mm256_and_si256(_mm256_or_si256(x, _mm256_slli_epi64(x, 2)),
+                        _mm256_set1_epi64x(0x3333333333333333ULL));
+   x = _mm256_and_si256(_mm256_or_si256(x, _mm256_slli_epi64(x, 1)),
+                        _mm256_set1_epi64x(0x5555555555555555ULL));
+   return x;
+}
+
+__attribute__ ((target("avx2")))
+static void
+bin_avx2(Context * ctx, int first, int last, double x_step,
+         double y_step)
+{
+   Workspace *ws = ctx->ws;
+   const __m256d min_x = _mm256_set1_pd(ctx->x_min);
+   const __m256d min_y = _mm256_set1_pd(ctx->y_min);
+   const __m256d step_x = _mm256_set1_pd(x_step);
+   const __m256d step_y = _mm256_set1_pd(y_step);
+   const __m256d max_cell = _mm256_set1_pd((double) ((1ULL << MAX_LEVEL) - 1));
+   const __m256d magic = _mm256_set1_pd(INT_MAGIC);
+   const __m256i low = _mm256_set1_epi64x(0xFFFFFFFFULL);
+   int     i;
+
+   for (i = first; i + 4 <= last; i += 4) {
+      __m256d x = _mm256_div_pd(_mm256_sub_pd(_mm256_loadu_pd(ws->rot_x + i),
+                                              min_x), step_x);
+      __m256d y = _mm256_div_pd(_mm256_sub_pd(_mm256_loadu_pd(ws->rot_y + i),
+                                              min_y), step_y);
+
+      x = _mm256_add_pd(_mm256_min_pd(_mm256_floor_pd(x), max_cell), magic);
+      y = _mm256_add_pd(_mm256_min_pd(_mm256_floor_pd(y), max_cell), magic);
+
+      __m256i cell_x = spread_avx2(_mm256_and_si256(_mm256_castpd_si256(x),
+                                                    low));
+      __m256i cell_y = spread_avx2(_mm256_and_si256(_mm256_castpd_si256(y),
+                                                    low));
+
+      _mm256_storeu_si256((__m256i *) (ws->keys + i),
+                          _mm256_or_si256(_mm256_slli_epi64(cell_y, 1),
+                                          cell_x));
    }
 
-   /*
-    * Built some margin to be sure that all the cities are included in 
-    * * a box. 
-    */
-   _x_max += X_MARGIN;
-   _x_min -= X_MARGIN;
-   _y_max += Y_MARGIN;
-   _y_min -= Y_MARGIN;
+   bin_scalar(ctx, i, last, x_step, y_step);
+}
+#endif /* HAVE_MORTON_KERNELS */
+
+__attribute__ ((target("avx512f")))
+static void
+rotate_avx512(Context * ctx, int first, int last, double cos_rot,
+              double sin_rot, double *limits)
+{
+   const Tsp *tsp = ctx->tsp;
+   Workspace *ws = ctx->ws;
+   const __m512d c = _mm512_set1_pd(cos_rot);
+   const __m512d s = _mm512_set1_pd(sin_rot);
+   __m512d x_min = _mm512_set1_pd(limits[0]);
+   __m512d x_max = _mm512_set1_pd(limits[1]);
+   __m512d y_min = _mm512_set1_pd(limits[2]);
+   __m512d y_max = _mm512_set1_pd(limits[3]);
+   int     i;
+
+   for (i = first; i + 8 <= last; i += 8) {
+      __m512d x = _mm512_loadu_pd(tsp->x + i);
+      __m512d y = _mm512_loadu_pd(tsp->y + i);
+      __m512d rot_x = _mm512_add_pd(_mm512_mul_pd(x, c), _mm512_mul_pd(y, s));
+      __m512d rot_y = _mm512_sub_pd(_mm512_mul_pd(y, c), _mm512_mul_pd(x, s));
+
+      _mm512_storeu_pd(ws->rot_x + i, rot_x);
+      _mm512_storeu_pd(ws->rot_y + i, rot_y);
+
+      x_min = _mm512_min_pd(x_min, rot_x);
+      x_max = _mm512_max_pd(x_max, rot_x);
+      y_min = _mm512_min_pd(y_min, rot_y);
+      y_max = _mm512_max_pd(y_max, rot_y);
+   }
+
+   limits[0] = _mm512_reduce_min_pd(x_min);
+   limits[1] = _mm512_reduce_max_pd(x_max);
+   limits[2] = _mm512_reduce_min_pd(y_min);
+   limits[3] = _mm512_reduce_max_pd(y_max);
+
+   rotate_scalar(ctx, i, last, cos_rot, sin_rot, limits);
+}
+
+#ifdef HAVE_MORTON_KERNELS
+__attribute__ ((target("avx512f")))
+static inline __m512i
+spread_avx512(__m512i x)
+{
+   x = _mm512_and_si512(_mm512_or_si512(x, _mm512_slli_epi64(x, 16)),
+                        _mm512_set1_epi64(0x0000FFFF0000FFFFULL));
+   x = _mm512_and_si512(_mm512_or_si512(x, _mm512_slli_epi64(x, 8)),
+                        _mm512_set1_epi64(0x00FF00FF00FF00FFULL));
+   x = _mm512_and_si512(_mm512_or_si512(x, _mm512_slli_epi64(x, 4)),
+                        _mm512_set1_epi64(0x0F0F0F0F0F0F0F0FULL));
+   x = _mm512_and_si512(_mm512_or_si512(x, _mm512_slli_epi64(x, 2)),
+                        _mm512_set1_epi64(0x3333333333333333ULL));
+   x = _mm512_and_si512(_mm512_or_si512(x, _mm512_slli_epi64(x, 1)),
+                        _mm512_set1_epi64(0x5555555555555555ULL));
+   return x;
+}
+
+__attribute__ ((target("avx512f")))
+static void
+bin_avx512(Context * ctx, int first, int last, double x_step,
+           double y_step)
+{
+   Workspace *ws = ctx->ws;
+   const __m512d min_x = _mm512_set1_pd(ctx->x_min);
+   const __m512d min_y = _mm512_set1_pd(ctx->y_min);
+   const __m512d step_x = _mm512_set1_pd(x_step);
+   const __m512d step_y = _mm512_set1_pd(y_step);
+   const __m512d max_cell = _mm512_set1_pd((double) ((1ULL << MAX_LEVEL) - 1));
+   const __m512d magic = _mm512_set1_pd(INT_MAGIC);
+   const __m512i low = _mm512_set1_epi64(0xFFFFFFFFULL);
+   int     i;
+
+   for (i = first; i + 8 <= last; i += 8) {
+      __m512d x = _mm512_div_pd(_mm512_sub_pd(_mm512_loadu_pd(ws->rot_x + i),
+                                              min_x), step_x);
+      __m512d y = _mm512_div_pd(_mm512_sub_pd(_mm512_loadu_pd(ws->rot_y + i),
+                                              min_y), step_y);
+
+      x = _mm512_add_pd(_mm512_min_pd(_mm512_roundscale_pd(x, ROUND_DOWN),
+                                      max_cell), magic);
+      y = _mm512_add_pd(_mm512_min_pd(_mm512_roundscale_pd(y, ROUND_DOWN),
+                                      max_cell), magic);
+
+      __m512i cell_x = spread_avx512(_mm512_and_si512(_mm512_castpd_si512(x),
+                                                      low));
+      __m512i cell_y = spread_avx512(_mm512_and_si512(_mm512_castpd_si512(y),
+                                                      low));
+
+      _mm512_storeu_si512((void *) (ws->keys + i),
+                          _mm512_or_si512(_mm512_slli_epi64(cell_y, 1),
+                                          cell_x));
+   }
+
+   bin_scalar(ctx, i, last, x_step, y_step);
+}
+#endif /* HAVE_MORTON_KERNELS */
+#endif
+
+/*
+ * Sort the keys, together with their cities, with a least significant digit
+ * radix sort. Passes in which all keys have the same digit are skipped.
+ */
+static void
+sort_keys(Workspace * ws)
+{
+   unsigned int count[256];
+
+   for (unsigned int shift = 0; shift < 64; shift += 8) {
+      for (int d = 0; d < 256; d++)
+         count[d] = 0;
+      for (int i = 0; i < ws->num_cities; i++)
+         count[(ws->keys[i] >> shift) & 0xff]++;
+
+      if (count[ws->keys[0] >> shift & 0xff] ==
+          (unsigned int) ws->num_cities)
+         continue;
+
+      for (unsigned int d = 0, sum = 0; d < 256; d++) {
+         unsigned int c = count[d];
+         count[d] = sum;
+         sum += c;
+      }
+      for (int i = 0; i < ws->num_cities; i++) {
+         unsigned int pos = count[(ws->keys[i] >> shift) & 0xff]++;
+         ws->tmp_keys[pos] = ws->keys[i];
+         ws->tmp_order[pos] = ws->order[i];
+      }
+
+      /*
+       * Swap the buffers, the sorted keys are in the temporary buffers now. 
+       */
+      uint64_t *keys = ws->keys;
+      int    *order = ws->order;
+      ws->keys = ws->tmp_keys;
+      ws->order = ws->tmp_order;
+      ws->tmp_keys = keys;
+      ws->tmp_order = order;
+   }
+}
+
+/*
+ * Sort the keys of the cities again, from the order of the previous rotation,
+ * with an insertion sort. After a small rotation only the cities which cross
+ * a cell boundary move, so the cost follows the number of crossings. Equal 
+ * keys are ordered on their city, which is the order of sort_keys(). Returns
+ * 0 without sorting if the cities move further than one radix pass would 
+ * cost.
+ */
+static int
+resort_keys(Workspace * ws)
+{
+   uint64_t *keys = ws->tmp_keys;
+   int    *order = ws->tmp_order;
+   long    budget = ws->num_cities;
+
+   for (int i = 0; i < ws->num_cities; i++) {
+      int     city = ws->order[i];
+      uint64_t key = ws->keys[city];
+      int     j = i;
+
+      while (j > 0 && (keys[j - 1] > key ||
+                       (keys[j - 1] == key && order[j - 1] > city))) {
+         if (--budget < 0)
+            return 0;
+         keys[j] = keys[j - 1];
+         order[j] = order[j - 1];
+         j--;
+      }
+      keys[j] = key;
+      order[j] = city;
+   }
+
+   ws->tmp_keys = ws->keys;
+   ws->tmp_order = ws->order;
+   ws->keys = keys;
+   ws->order = order;
+   return 1;
+}
+
+/*
+ * Returns the key of the cell (x, y) on the finest grid.
+ */
+static uint64_t
+cell_key(uint32_t x, uint32_t y)
+{
+#if CELL_SIDE == 2
+   return (spread_bits(y) << 1) | spread_bits(x);
+#else
+   uint64_t key = 0;
+   uint64_t digit = 1;
+
+   for (unsigned int l = 0; l < MAX_LEVEL; l++) {
+      key += (uint64_t) (y % CELL_SIDE * CELL_SIDE + x % CELL_SIDE) * digit;
+      x /= CELL_SIDE;
+      y /= CELL_SIDE;
+      digit *= SUBCELLS;
+   }
+   return key;
+#endif
+}
+
+/*
+ * Returns the number of levels at which the keys a and b are in the same 
+ * cell, scales holds key_scale() of every level.
+ */
+static unsigned int
+common_levels(uint64_t a, uint64_t b, const uint64_t *scales)
+{
+#if CELL_SIDE == 2
+   (void) scales;
+   if (a == b)
+      return MAX_LEVEL;
+   return (__builtin_clzll(a ^ b) - (64 - 2 * MAX_LEVEL)) / 2;
+#else
+   unsigned int level = 0;
+
+   while (level < MAX_LEVEL &&
+          a / scales[level + 1] == b / scales[level + 1])
+      level++;
+   return level;
+#endif
+}
+
+/*
+ * Returns the level at which the sorted city i is placed on the route, the
+ * first level at which its cell holds at most leaf cities. That is the case
+ * if no run of leaf + 1 sorted keys through i shares the cell.
+ */
+static unsigned int
+placed_level(const Workspace * ws, int i, int leaf, const uint64_t *scales)
+{
+   unsigned int level = 0;
+
+   for (int j = i - leaf; j <= i; j++)
+      if (j >= 0 && j + leaf < ws->num_cities) {
+         unsigned int l = common_levels(ws->keys[j], ws->keys[j + leaf],
+                                        scales);
+         if (l > level)
+            level = l;
+      }
+   return (level < MAX_LEVEL) ? level + 1 : MAX_LEVEL;
+}
+
+/*
+ * Returns the step after which a position u, which moves at rate du, passes
+ * the next integer.
+ */
+static double
+crossing_step(double u, double du)
+{
+   if (du > 0)
+      return (floor(u) + 1 - u) / du;
+   if (du < 0)
+      return (u - floor(u)) / -du;
+   return INFINITY;
+}
+
+/*
+ * The finalizer of SplitMix64, every bit of the result depends on every bit
+ * of v.
+ */
+static uint64_t
+mix_bits(uint64_t v)
+{
+   v = (v ^ (v >> 30)) * 0xbf58476d1ce4e5b9ULL;
+   v = (v ^ (v >> 27)) * 0x94d049bb133111ebULL;
+   return v ^ (v >> 31);
+}
+
+#if CELL_SIDE == 2
+/*
+ * Spread the 32 bits of v over the even bits of a 64 bit word.
+ */
+static uint64_t
+spread_bits(uint32_t v)
+{
+   uint64_t x = v;
+
+   x = (x | (x << 16)) & 0x0000FFFF0000FFFFULL;
+   x = (x | (x << 8)) & 0x00FF00FF00FF00FFULL;
+   x = (x | (x << 4)) & 0x0F0F0F0F0F0F0F0FULL;
+   x = (x | (x << 2)) & 0x3333333333333333ULL;
+   x = (x | (x << 1)) & 0x5555555555555555ULL;
+
+   return x;
+}
+
+/*
+ * The inverse of spread_bits(), collect the even bits of v.
+ */
+static uint32_t
+compact_bits(uint64_t v)
+{
+   uint64_t x = v & 0x5555555555555555ULL;
+
+   x = (x | (x >> 1)) & 0x3333333333333333ULL;
+   x = (x | (x >> 2)) & 0x0F0F0F0F0F0F0F0FULL;
+   x = (x | (x >> 4)) & 0x00FF00FF00FF00FFULL;
+   x = (x | (x >> 8)) & 0x0000FFFF0000FFFFULL;
+   x = (x | (x >> 16)) & 0x00000000FFFFFFFFULL;
+
+   return (uint32_t) x;
 }
+#endif
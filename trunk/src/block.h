@@ -2,6 +2,7 @@
 #define BLOCK_H
 
 #include <stdio.h>
+#include <stdint.h>
 #include <math.h>
 #include <stdio.h>
 
@@ -12,58 +13,91 @@
 
 /* Define the value which is returned when no city is in the block. */
 #define NO_CITY -1
-#define MANY_CITIES -2
-#define INIT_INDEX -3
 
-/* Sets the rotation of the blocks. */
-extern double rotation;
+/*
+ * At every level a cell is split in CELL_SIDE by CELL_SIDE subcells, the 
+ * side is chosen when tsp is configured.
+ */
+#ifndef CELL_SIDE
+#define CELL_SIDE 2
+#endif
+#define SUBCELLS (CELL_SIDE * CELL_SIDE)
 
-typedef struct
+/*
+ * The rotated cities are binned once per rotation on a grid of GRID_SIZE by
+ * GRID_SIZE cells, GRID_SIZE is CELL_SIDE^MAX_LEVEL. The cell of a city is 
+ * stored as a key of which the digits in base SUBCELLS are the subcells at
+ * every level, so the cell at a coarser level is found by dividing the key
+ * by key_scale(). For a side of two this is the Morton (Z-order) key, and
+ * dividing is shifting.
+ */
+#if CELL_SIDE == 2
+#define MAX_LEVEL 31
+#define GRID_SIZE (1ULL << MAX_LEVEL)
+#elif CELL_SIDE == 3
+#define MAX_LEVEL 20
+#define GRID_SIZE 3486784401ULL
+#else
+#error "CELL_SIDE must be 2 or 3"
+#endif
+
+/* Returns the number of cells at MAX_LEVEL in one cell at level. */
+static inline uint64_t
+key_scale(unsigned int level)
 {
-   int    *block_cty;
-   int    *block_idx;
-   int     filled_blocks;
-   unsigned int length;
-   unsigned int height;
-} grd;
+#if CELL_SIDE == 2
+   return (uint64_t) 1 << 2 * (MAX_LEVEL - level);
+#else
+   uint64_t scale = 1;
+
+   for (unsigned int l = level; l < MAX_LEVEL; l++)
+      scale *= SUBCELLS;
+   return scale;
+#endif
+}
 
-/* Create a sparse grid consisting of *length by *height fields. */
-grd    *create_grd(const unsigned int *length, const unsigned int *height);
-/* Free a grid object. */
-void    free_grd(grd * grid);
-/* 
- * Returns NO_CITY if no city is present in the grid at (*x, *y)
- * Returns MANY_CITIES if more than one city is present in the grid at (*x, *y)
- * Returns the city number if one city is present in the grid at (*x, *y)
+/*
+ * Rotate the cities and sort them on their cell, if the rotation of ctx has
+ * changed. Within the sorted order the cities of one cell are adjacent at 
+ * every level.
  */
-int     has_city(grd * grid, int x, int y);
+void    sort_cities(Context * ctx);
+/*
+ * Split the sorted cities lo up to hi, which form one cell at level - 1, in 
+ * the SUBCELLS subcells at level. The cities of the subcell at (x, y), with x
+ * and y below CELL_SIDE, are bounds[CELL_SIDE * y + x] up to 
+ * bounds[CELL_SIDE * y + x + 1].
+ */
+void    split_cell(const Context * ctx, unsigned int level, int lo, int hi,
+                   int *bounds);
+/* Returns the city at position i in the sorted order. */
+int     sorted_city(const Context * ctx, int i);
+/* Find the coordinates of the cell at level of a key. */
+void    key_cell(uint64_t key, unsigned int level, unsigned int *x,
+                 unsigned int *y);
+/*
+ * Returns a signature of the sorted cities. Every city is placed on the 
+ * route at the first level at which its cell holds at most leaf cities, and
+ * the signature is a hash of these cells. Rotations with the same signature
+ * give the same blocks at every level.
+ */
+uint64_t grid_signature(const Context * ctx, int leaf);
+/*
+ * Returns the rotation step after which the first city crosses the border of
+ * its cell at the level at which it is placed, to first order in the step. 
+ * The cities move on circles and the limits of the plane follow other cities
+ * after a while, so the step is only an estimate. The cities must be sorted.
+ */
+double  rotation_step(const Context * ctx, int leaf);
 
 /*
- * The following two functions can be used to print the boxes which represent 
- * the grid. The functions save all the data in a space seperated format with
- * a header. These files can be read with R (see cran.r-project.org) and 
- * plotted. Using commands like this:
+ * Print the rotated cities in a space separated format with a header. The 
+ * file can be read with R (see cran.r-project.org) and plotted, using 
+ * commands like this:
  *
- * # Read the cities saved with the function print_cities()
  * cities<-read.table("cities",header=T)
- * # Plot the cities.
  * plot(cities$city_x, cities$city_y,axes=F)
- * 
- * # Read the lines which represent the grid. This file is saved 
- * # using print_grd_lines()
- * lines<-read.table("lines",header=T)
- * # Plot the lines.
- * lines(as.vector(lines))
- *
- * # Read the center dots of each box. If no cities are in the box the point
- * # is a diamond, if there is one city is a solid circle. In the
- * # case there are multiple cities the centre is a triangle with point up.
- * points<-read.table("points",header=T)
- * # Plot the points.
- * points(points$x, points$y, pch=points$pch)
  */
-void    print_grd_lines(grd * grid, FILE * f);
-void    print_grd_points(grd * grid, FILE * f);
-void    print_cities(FILE * f);
+void    print_cities(const Context * ctx, FILE * f);
 
 #endif /* BLOCK_H */
@@ -0,0 +1,107 @@
+#include <err.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sysexits.h>
+#include <assert.h>
+
+#include "cache.h"
+
+struct cache
+{
+   int     entries;
+   int     num_cities;
+   /* The number of entries which are used. */
+   int     used;
+   /* The signature, length and route of every entry. */
+   uint64_t *sign;
+   double *length;
+   int    *tours;
+   /* The time at which every entry is used last. */
+   unsigned long *stamp;
+   unsigned long clock;
+};
+
+static int find_entry(const Cache * cache, uint64_t sign);
+
+Cache  *
+create_cache(int entries, int num_cities)
+{
+   Cache  *cache;
+
+   assert(entries > 0 && num_cities > 0);
+
+   if ((cache = calloc(1, sizeof(Cache))) == NULL ||
+       (cache->sign = calloc(entries, sizeof(uint64_t))) == NULL ||
+       (cache->length = calloc(entries, sizeof(double))) == NULL ||
+       (cache->stamp = calloc(entries, sizeof(unsigned long))) == NULL ||
+       (cache->tours = calloc((size_t) entries * num_cities,
+                              sizeof(int))) == NULL)
+      errx(EX_OSERR, "Not enough memory!");
+
+   cache->entries = entries;
+   cache->num_cities = num_cities;
+   return cache;
+}
+
+void
+free_cache(Cache * cache)
+{
+   assert(cache != NULL);
+
+   free(cache->sign);
+   free(cache->length);
+   free(cache->stamp);
+   free(cache->tours);
+   free(cache);
+}
+
+double
+cache_find(Cache * cache, uint64_t sign, int *tour)
+{
+   int     i = find_entry(cache, sign);
+
+   if (i < 0)
+      return -1;
+
+   cache->stamp[i] = ++cache->clock;
+   if (tour != NULL)
+      memcpy(tour, cache->tours + (size_t) i * cache->num_cities,
+             cache->num_cities * sizeof(int));
+   return cache->length[i];
+}
+
+void
+cache_store(Cache * cache, uint64_t sign, double length, const int *tour)
+{
+   int     i = find_entry(cache, sign);
+
+   /*
+    * Take a free entry, or else the one which is used least recently.
+    */
+   if (i < 0 && cache->used < cache->entries)
+      i = cache->used++;
+   else if (i < 0) {
+      i = 0;
+      for (int j = 1; j < cache->entries; j++)
+         if (cache->stamp[j] < cache->stamp[i])
+            i = j;
+   }
+
+   cache->sign[i] = sign;
+   cache->length[i] = length;
+   cache->stamp[i] = ++cache->clock;
+   memcpy(cache->tours + (size_t) i * cache->num_cities, tour,
+          cache->num_cities * sizeof(int));
+}
+
+/*
+ * Returns the entry with signature sign, or -1 if there is none.
+ */
+static int
+find_entry(const Cache * cache, uint64_t sign)
+{
+   for (int i = 0; i < cache->used; i++)
+      if (cache->sign[i] == sign)
+         return i;
+   return -1;
+}
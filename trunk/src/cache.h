@@ -0,0 +1,27 @@
+#ifndef CACHE_H
+#define CACHE_H
+
+#include <stdint.h>
+
+/*
+ * A small cache of routes, keyed on the signature of the grid from which
+ * they are built, see grid_signature(). When it is full the entry which is
+ * used least recently is replaced.
+ */
+typedef struct cache Cache;
+
+/* Create a cache of entries routes through num_cities cities. */
+Cache  *create_cache(int entries, int num_cities);
+/* Free a cache object. */
+void    free_cache(Cache * cache);
+/*
+ * Find the route with signature sign. Returns its length and copies the
+ * route to tour if tour is not NULL, returns a negative length if the route
+ * is not in the cache.
+ */
+double  cache_find(Cache * cache, uint64_t sign, int *tour);
+/* Store the route tour of length length with signature sign. */
+void    cache_store(Cache * cache, uint64_t sign, double length,
+                    const int *tour);
+
+#endif /* CACHE_H */
@@ -0,0 +1,80 @@
+#include <err.h>
+#include <stdlib.h>
+#include <sysexits.h>
+#include <assert.h>
+#include <math.h>
+
+#include "context.h"
+
+Context *
+create_context(const Tsp * tsp)
+{
+   Context *ctx;
+
+   assert(tsp != NULL);
+
+   if ((ctx = calloc(1, sizeof(Context))) == NULL)
+      errx(EX_OSERR, "Not enough memory!");
+
+   ctx->tsp = tsp;
+   ctx->rotation = 0;
+   ctx->sorted_rotation = NAN;
+   ctx->leaf_cities = LEAF_CITIES;
+   ctx->levels = MAX_LEVEL;
+   ctx->entry = NO_NODE;
+   ctx->departure = NO_NODE;
+   ctx->ws = create_workspace(tsp);
+
+   if ((ctx->tour = calloc(tsp->dimension, sizeof(int))) == NULL)
+      errx(EX_OSERR, "Not enough memory!");
+   if ((ctx->bm_rng = gsl_rng_alloc(gsl_rng_taus)) == NULL)
+      errx(EX_OSERR, "Not enough memory!");
+   ctx->seed = gsl_rng_default_seed;
+
+   return ctx;
+}
+
+void
+free_context(Context * ctx)
+{
+   assert(ctx != NULL);
+
+   if (ctx->pool != NULL)
+      free_pool(ctx->pool);
+   if (ctx->cache != NULL)
+      free_cache(ctx->cache);
+   gsl_rng_free(ctx->bm_rng);
+   free(ctx->tour);
+   free_workspace(ctx->ws);
+   free(ctx);
+}
+
+void
+context_threads(Context * ctx, int threads)
+{
+   assert(ctx != NULL && threads > 0);
+
+   if (ctx->pool != NULL)
+      free_pool(ctx->pool);
+   ctx->pool = (threads > 1) ? create_pool(threads) : NULL;
+}
+
+void
+context_cache(Context * ctx, int entries)
+{
+   assert(ctx != NULL && entries >= 0);
+
+   if (ctx->cache != NULL)
+      free_cache(ctx->cache);
+   ctx->cache = (entries > 0) ?
+       create_cache(entries, ctx->tsp->dimension) : NULL;
+}
+
+void
+seed_context(Context * ctx, unsigned long seed)
+{
+   assert(ctx != NULL);
+
+   ctx->seed = seed;
+   gsl_rng_set(ctx->bm_rng, seed);
+}
@@ -0,0 +1,91 @@
+#ifndef CONTEXT_H
+#define CONTEXT_H
+
+#include <gsl/gsl_rng.h>
+
+#include "tsp.h"
+#include "distance.h"
+#include "renormalization.h"
+#include "workspace.h"
+#include "pool.h"
+#include "cache.h"
+
+/*
+ * The state of one solver. Every function which renormalizes a tsp gets the
+ * context to work on, so several solvers can run at the same time in one 
+ * process. The tsp and the precomputed routes are shared between them and
+ * are never changed.
+ */
+struct context
+{
+   const Tsp *tsp;
+   /* The rotation of the grid. */
+   double  rotation;
+
+   /*
+    * The rotation for which the cities in the workspace are sorted, and the
+    * limits of the rotated plane. NAN if nothing is sorted yet.
+    */
+   double  sorted_rotation;
+   double  x_min;
+   double  x_max;
+   double  y_min;
+   double  y_max;
+
+   Workspace *ws;
+   /* The threads which build a route, NULL if it is built serially. */
+   Pool   *pool;
+   /* The complete routes which are built last, NULL if none are cached. */
+   Cache  *cache;
+   /*
+    * The cells with at most this many cities are solved exactly instead of
+    * refined, at most LEAF_MAX. Below two every cell is refined.
+    */
+   int     leaf_cities;
+   /*
+    * The number of levels which the annealing leaves out at its begin 
+    * temperature, see thermo_sa(), and the number of levels of the last 
+    * route which was built completely.
+    */
+   int     coarse_levels;
+   unsigned int levels;
+
+   /*
+    * The border points of the plane at which the route enters and departs,
+    * see get_open_route(). NO_NODE for a closed route.
+    */
+   int     entry;
+   int     departure;
+
+   /* The route which is built, NULL if only its length is needed. */
+   int    *result;
+   /* The length of the route, if it is computed while the route is built. */
+   Length *length;
+
+   /* The best tour which is found by the annealing, its length and rotation. */
+   int    *tour;
+   double  best_energy;
+   double  best_rotation;
+   /*
+    * The seed of the annealing and the random number generator of the 
+    * Brownian motion.
+    */
+   unsigned long seed;
+   gsl_rng *bm_rng;
+};
+
+/* Create a context for solving tsp. */
+Context *create_context(const Tsp * tsp);
+/* Free a context object. */
+void    free_context(Context * ctx);
+/* Build the routes of ctx with the given number of threads. */
+void    context_threads(Context * ctx, int threads);
+/*
+ * Cache the last entries routes of ctx, none if entries is 0. Routes are 
+ * only cached while ctx->leaf_cities is below 2, see renormalize_depth().
+ */
+void    context_cache(Context * ctx, int entries);
+/* Seed the random number generators of ctx. */
+void    seed_context(Context * ctx, unsigned long seed);
+
+#endif /* CONTEXT_H */
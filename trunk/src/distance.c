@@ -4,47 +4,24 @@
 
 #include "tsp.h"
 #include "distance.h"
+#include "context.h"
 
 double
-route_length(const int *route, int num_cities)
+route_length(const Context * ctx, const int *route, int num_cities)
 {
    assert(num_cities != 0);
    assert(route != NULL);
-   assert(tsp != NULL);
-   assert(tsp->distance_type == EUC_2D);
+   assert(ctx != NULL);
+   assert(ctx->tsp->distance_type == EUC_2D);
 
-   double  length;
-   double  height;
-   double  route_lngth = 0;
-   City   *city_curr, *city_nxt;
+   const Tsp *tsp = ctx->tsp;
+   Length  length = { 0, 0 };
 
-   for (unsigned int i = 0; i < (num_cities - 1); i++) {
-      assert(route[i] < tsp->dimension);
-
-      /*
-       * Temporary assign the cities to readable variables. 
-       */
-      city_curr = &tsp->cities[route[i]];
-      city_nxt = &tsp->cities[route[i + 1]];
-
-      /*
-       * Cities should be different. 
-       */
-      assert(city_curr != city_nxt);
+   for (int i = 0; i < num_cities; i++) {
+      int     next = (i + 1 < num_cities) ? route[i + 1] : route[0];
 
-      /*
-       * Use Pythagoras law to compute the distance. 
-       */
-      length = city_curr->x - city_nxt->x;
-      height = city_curr->y - city_nxt->y;
-      route_lngth += sqrt(length * length + height * height);
+      assert(route[i] < tsp->dimension);
+      add_length(&length, city_distance(tsp, route[i], next));
    }
-   city_curr = &tsp->cities[route[tsp->dimension - 1]];
-   city_nxt = &tsp->cities[route[0]];
-
-   length = city_curr->x - city_nxt->x;
-   height = city_curr->y - city_nxt->y;
-   route_lngth += sqrt(length * length + height * height);   
-   
-   return route_lngth;
+   return total_length(&length);
 }
@@ -1,6 +1,20 @@
 #ifndef DISTANCE_H
 #define DISTANCE_H
 
+#include <math.h>
+
+#include "tsp.h"
+
+/*
+ * A length which is accumulated with compensated (Neumaier) summation, so
+ * the rounding error does not grow with the number of edges.
+ */
+typedef struct
+{
+   double  sum;
+   double  comp;
+} Length;
+
 /*
  * Compute the distance between cities.
  *
@@ -8,6 +22,42 @@
  *			is an array of ints.
  * num_cities The number of cities in the route.
  */
-double  route_length(const int *route, int num_cities);
+double  route_length(const Context * ctx, const int *route, int num_cities);
+
+/*
+ * The distance between the cities a and b of tsp.
+ */
+static inline double
+city_distance(const Tsp * tsp, int a, int b)
+{
+   double  length = tsp->x[a] - tsp->x[b];
+   double  height = tsp->y[a] - tsp->y[b];
+
+   return sqrt(length * length + height * height);
+}
+
+/*
+ * Add the distance d to the length l.
+ */
+static inline void
+add_length(Length * l, double d)
+{
+   double  t = l->sum + d;
+
+   if (fabs(l->sum) >= fabs(d))
+      l->comp += (l->sum - t) + d;
+   else
+      l->comp += (d - t) + l->sum;
+   l->sum = t;
+}
+
+/*
+ * The accumulated length, including the compensation.
+ */
+static inline double
+total_length(const Length * l)
+{
+   return l->sum + l->comp;
+}
 
 #endif
@@ -10,15 +10,74 @@
 
 Tsp    *
 import_tsp(FILE * file)
+{
+   int     arg_int;
+   double  arg_double0, arg_double1;
+   Tsp    *result;
+
+   result = import_header(file);
+
+   if (((result->cities = calloc(result->dimension, sizeof(City))) == NULL)
+       || ((result->tour = calloc(result->dimension, sizeof(int))) == NULL))
+      errx(EX_OSERR, "Out of memory");
+
+   /*
+    * Read the cities. 
+    */
+   while (import_city(file, &arg_int, &arg_double0, &arg_double1)) {
+      if (arg_int < 1 || arg_int > result->dimension)
+         errx(EX_DATAERR, "Incorrect city index\n");
+
+      result->cities[arg_int - 1].x = arg_double0;
+      result->cities[arg_int - 1].y = arg_double1;
+   }
+
+   for (arg_int = 0; arg_int < result->dimension; arg_int++)
+      result->tour[arg_int] = arg_int;
+
+   /*
+    * Center all the cities around the origin. 
+    */
+   double  x_max = -FP_INFINITE;
+   double  x_min = FP_INFINITE;
+   double  y_max = -FP_INFINITE;
+   double  y_min = FP_INFINITE;
+
+   for (int i = 0; i < result->dimension; i++) {
+      if (result->cities[i].x > x_max)
+         x_max = result->cities[i].x;
+      if (result->cities[i].x < x_min)
+         x_min = result->cities[i].x;
+      if (result->cities[i].y > y_max)
+         y_max = result->cities[i].y;
+      if (result->cities[i].y < y_min)
+         y_min = result->cities[i].y;
+   }
+
+   for (int i = 0; i < result->dimension; i++) {
+      result->cities[i].x -= (x_max - x_min) / 2.0;
+      result->cities[i].y -= (y_max - y_min) / 2.0;
+   }
+
+   if (((result->x = calloc(result->dimension, sizeof(double))) == NULL)
+       || ((result->y = calloc(result->dimension, sizeof(double))) == NULL))
+      errx(EX_OSERR, "Out of memory");
+
+   for (int i = 0; i < result->dimension; i++) {
+      result->x[i] = result->cities[i].x;
+      result->y[i] = result->cities[i].y;
+   }
+
+   return result;
+}
+
+Tsp    *
+import_header(FILE * file)
 {
    char    buffer[128];
    char    arg_string[64];
    int     arg_int;
-   double  arg_double0, arg_double1;
-   int     header_finished;
-   double  x, y;
    Tsp    *result;
-   char   *suc;
 
    if ((result = calloc(1, sizeof(Tsp))) == NULL)
       errx(EX_OSERR, "Out of memory\n");
@@ -60,52 +119,19 @@ import_tsp(FILE * file)
    if (result->dimension <= 0)
       errx(EX_DATAERR, "No dimension specified, or invalid one");
 
-   if (((result->cities = calloc(result->dimension, sizeof(City))) == NULL)
-       || ((result->tour = calloc(result->dimension, sizeof(int))) == NULL))
-      errx(EX_OSERR, "Out of memory");
-
-   /*
-    * Read the cities. 
-    */
-   while (fgets(buffer, 128, file)) {
-      if (sscanf(buffer, "%d %lf %lf", &arg_int, &arg_double0, &arg_double1)
-          == 3) {
-         if (arg_int > result->dimension)
-            errx(EX_DATAERR, "Incorrect city index\n");
-
-         result->cities[arg_int - 1].x = arg_double0;
-         result->cities[arg_int - 1].y = arg_double1;
-      }
-   }
-
-   for (arg_int = 0; arg_int < result->dimension; arg_int++)
-      result->tour[arg_int] = arg_int;
-
-   /*
-    * Center all the cities around the origin. 
-    */
-   double  x_max = -FP_INFINITE;
-   double  x_min = FP_INFINITE;
-   double  y_max = -FP_INFINITE;
-   double  y_min = FP_INFINITE;
+   return result;
+}
 
-   for (int i = 0; i < result->dimension; i++) {
-      if (result->cities[i].x > x_max)
-         x_max = result->cities[i].x;
-      if (result->cities[i].x < x_min)
-         x_min = result->cities[i].x;
-      if (result->cities[i].y > y_max)
-         y_max = result->cities[i].y;
-      if (result->cities[i].y < y_min)
-         y_min = result->cities[i].y;
-   }
+int
+import_city(FILE * file, int *index, double *x, double *y)
+{
+   char    buffer[128];
 
-   for (int i = 0; i < result->dimension; i++) {
-      result->cities[i].x -= (x_max - x_min) / 2.0;
-      result->cities[i].y -= (y_max - y_min) / 2.0;
-   }
+   while (fgets(buffer, 128, file))
+      if (sscanf(buffer, "%d %lf %lf", index, x, y) == 3)
+         return 1;
 
-   return result;
+   return 0;
 }
 
 void
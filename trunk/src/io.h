@@ -4,6 +4,16 @@
 #include "tsp.h"
 
 Tsp    *import_tsp(FILE * file);
+/*
+ * Read the header of a tsp file, the returned tsp has no cities yet. The 
+ * cities follow with import_city().
+ */
+Tsp    *import_header(FILE * file);
+/*
+ * Read the next city of a tsp file, after its header. Returns 0 at the end 
+ * of the file.
+ */
+int     import_city(FILE * file, int *index, double *x, double *y);
 void    export_tsp(FILE * stream, Tsp * tsp);
 
 #endif
@@ -0,0 +1,64 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <sysexits.h>
+
+#include "routes.h"
+
+/*
+ * Generate the table of routes through a block, see routes.h. The routes are
+ * printed as C source on the standard output, so the table is computed when
+ * tsp is built instead of at every start.
+ */
+
+static Route _table[ROUTE_IDS];
+
+static void print_bytes(const uint8_t * bytes, int size);
+
+int
+main(void)
+{
+   const Route *route;
+
+   compute_routes(_table);
+
+   (void) printf("/* Generated by mkroutes for a cell side of %d, "
+                 "do not edit. */\n\n", CELL_SIDE);
+   (void) printf("#include \"routes.h\"\n\n");
+   (void) printf("#if CELL_SIDE != %d\n", CELL_SIDE);
+   (void) printf("#error \"The route table is generated for another cell "
+                 "side\"\n#endif\n\n");
+   (void) printf("const Route _routes[ROUTE_IDS]\n"
+                 "    __attribute__ ((aligned(64))) = {\n");
+
+   for (int id = 0; id < ROUTE_IDS; id++) {
+      route = &_table[id];
+
+      /*
+       * The length is printed in hexadecimal, so it is exact.
+       */
+      (void) printf("   {%a, ", route->length);
+      print_bytes(route->trace, TRACE_NODES);
+      (void) printf(", %d,\n    ", route->trace_length);
+      print_bytes(route->visits, CELL_NODES);
+      (void) printf(", ");
+      print_bytes(route->start, CELL_NODES);
+      (void) printf(", ");
+      print_bytes(route->end, CELL_NODES);
+      (void) printf("},\n");
+   }
+   (void) printf("};\n");
+
+   return fflush(stdout) == 0 ? EX_OK : EX_IOERR;
+}
+
+/*
+ * Print an array of nodes as an initializer.
+ */
+static void
+print_bytes(const uint8_t * bytes, int size)
+{
+   (void) printf("{");
+   for (int i = 0; i < size; i++)
+      (void) printf(i == 0 ? "%d" : ", %d", bytes[i]);
+   (void) printf("}");
+}
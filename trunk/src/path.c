@@ -5,8 +5,9 @@
 #include "tsp.h"
 
 void
-print_path(unsigned int *path, FILE * f)
+print_path(const Tsp * tsp, unsigned int *path, FILE * f)
 {
+   assert(tsp != NULL);
    assert(path != NULL);
    assert(f != NULL);
 
@@ -2,5 +2,8 @@
 #define PATH_H
 #include <stdio.h>
 
-void    print_path(unsigned int *path, FILE * f);
+#include "tsp.h"
+
+
+void    print_path(const Tsp * tsp, unsigned int *path, FILE * f);
 #endif
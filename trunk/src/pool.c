@@ -0,0 +1,154 @@
+#include <err.h>
+#include <stdlib.h>
+#include <sysexits.h>
+#include <assert.h>
+#include <pthread.h>
+
+#include "pool.h"
+
+struct pool
+{
+   pthread_t *workers;
+   int     num_workers;
+
+   pthread_mutex_t lock;
+   /* Signals the workers that there are new tasks, or that they must stop. */
+   pthread_cond_t work;
+   /* Signals pool_run() that all the tasks are finished. */
+   pthread_cond_t done;
+
+   void    (*task) (void *arg, int i);
+   void   *arg;
+   int     tasks;
+   int     next;
+   int     finished;
+   /* Counts the calls of pool_run(), so a worker sees if there is work. */
+   unsigned long generation;
+   int     stop;
+};
+
+static void *worker(void *arg);
+static void run_tasks(Pool * pool);
+
+Pool   *
+create_pool(int threads)
+{
+   Pool   *pool;
+
+   assert(threads > 0);
+
+   if ((pool = calloc(1, sizeof(Pool))) == NULL)
+      errx(EX_OSERR, "Not enough memory!");
+
+   pool->num_workers = threads - 1;
+   if (pool->num_workers > 0 &&
+       (pool->workers = calloc(pool->num_workers, sizeof(pthread_t))) == NULL)
+      errx(EX_OSERR, "Not enough memory!");
+
+   if (pthread_mutex_init(&pool->lock, NULL) != 0 ||
+       pthread_cond_init(&pool->work, NULL) != 0 ||
+       pthread_cond_init(&pool->done, NULL) != 0)
+      errx(EX_OSERR, "Unable to initialize the thread pool");
+
+   for (int i = 0; i < pool->num_workers; i++)
+      if (pthread_create(&pool->workers[i], NULL, worker, pool) != 0)
+         errx(EX_OSERR, "Unable to create a thread");
+
+   return pool;
+}
+
+void
+free_pool(Pool * pool)
+{
+   assert(pool != NULL);
+
+   pthread_mutex_lock(&pool->lock);
+   pool->stop = 1;
+   pthread_cond_broadcast(&pool->work);
+   pthread_mutex_unlock(&pool->lock);
+
+   for (int i = 0; i < pool->num_workers; i++)
+      pthread_join(pool->workers[i], NULL);
+
+   pthread_cond_destroy(&pool->done);
+   pthread_cond_destroy(&pool->work);
+   pthread_mutex_destroy(&pool->lock);
+
+   free(pool->workers);
+   free(pool);
+}
+
+int
+pool_threads(const Pool * pool)
+{
+   assert(pool != NULL);
+
+   return pool->num_workers + 1;
+}
+
+void
+pool_run(Pool * pool, int tasks, void (*task) (void *arg, int i), void *arg)
+{
+   assert(pool != NULL);
+   assert(task != NULL);
+
+   if (tasks <= 0)
+      return;
+
+   pthread_mutex_lock(&pool->lock);
+   pool->task = task;
+   pool->arg = arg;
+   pool->tasks = tasks;
+   pool->next = 0;
+   pool->finished = 0;
+   pool->generation++;
+   pthread_cond_broadcast(&pool->work);
+
+   run_tasks(pool);
+   while (pool->finished < pool->tasks)
+      pthread_cond_wait(&pool->done, &pool->lock);
+   pthread_mutex_unlock(&pool->lock);
+}
+
+/*
+ * Wait for tasks and run them, until the pool is freed.
+ */
+static void *
+worker(void *arg)
+{
+   Pool   *pool = arg;
+   unsigned long seen = 0;
+
+   pthread_mutex_lock(&pool->lock);
+   for (;;) {
+      while (!pool->stop && pool->generation == seen)
+         pthread_cond_wait(&pool->work, &pool->lock);
+      if (pool->stop)
+         break;
+
+      seen = pool->generation;
+      run_tasks(pool);
+   }
+   pthread_mutex_unlock(&pool->lock);
+
+   return NULL;
+}
+
+/*
+ * Take tasks until there are none left. The lock of the pool is held when
+ * this is called, but not while a task runs.
+ */
+static void
+run_tasks(Pool * pool)
+{
+   while (pool->next < pool->tasks) {
+      int     i = pool->next++;
+
+      pthread_mutex_unlock(&pool->lock);
+      pool->task(pool->arg, i);
+      pthread_mutex_lock(&pool->lock);
+
+      if (++pool->finished == pool->tasks)
+         pthread_cond_broadcast(&pool->done);
+   }
+}
@@ -0,0 +1,25 @@
+#ifndef POOL_H
+#define POOL_H
+
+/*
+ * A fixed set of threads which run the tasks 0 up to n of a function. The
+ * thread which calls pool_run() runs tasks as well, so a pool of one thread 
+ * has no extra threads at all.
+ */
+typedef struct pool Pool;
+
+/* Create a pool of threads threads. */
+Pool   *create_pool(int threads);
+/* Free a pool object, after all its threads have finished. */
+void    free_pool(Pool * pool);
+/* Returns the number of threads of the pool. */
+int     pool_threads(const Pool * pool);
+/*
+ * Run task(arg, i) for every i from 0 up to tasks on the threads of the 
+ * pool, and wait until they are all finished. The order in which the tasks
+ * are run is not defined.
+ */
+void    pool_run(Pool * pool, int tasks, void (*task) (void *arg, int i),
+                 void *arg);
+
+#endif /* POOL_H */
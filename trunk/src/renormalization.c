@@ -4,81 +4,175 @@
 #include <stdio.h>
 #include <err.h>
 #include <math.h>
+#include <string.h>
 
 #include "block.h"
 #include "tsp.h"
 #include "renormalization.h"
+#include "distance.h"
 #include "io.h"
+#include "context.h"
+#include "pool.h"
+#include "routes.h"
 
-static void node_offset(int node, double *x, double *y);
-static int point_on_edge(int edge_start, int edge_finish);
+/* The blocks of one level which is built by build_route(). */
+typedef struct
+{
+   Context *ctx;
+   unsigned int level;
+   Blocks *block_prev;
+   Blocks *block_new;
+   Part   *parts;
+} Level;
 
-/*
-  Weights of edges between nodes on the default block.
-  The default block is:
-
-  (4)------------(5)------------(6)
-  |               |              |
-  |     (0)       |      (1)     |
-  |               |              |
-  (7)---------------------------(8)
-  |               |              |
-  |     (2)       |     (3)      |
-  |               |              |
-  (9)------------(10)------------(11)
-
-  The weights of the possible edges are 0 if there is no edge,
-  and non zero if there is one
-*/
-static double _weights[NORMAL_NODES][NORMAL_NODES];
-
-Route  *_basic_start = NULL;
-Route  *_shortest_routes[BORDER_NODES][BORDER_NODES][BIT_CELL_MAX];
-static int *_result;
+static void node_offset(int node, double *x, double *y);
+static int use_cache(const Context * ctx, unsigned int depth);
+static void build_route(Context * ctx, Length * length, double limit,
+                        unsigned int depth);
+static void close_blocks(Context * ctx, const Blocks * blocks, int size);
+static double pending_bound(const Context * ctx, const Blocks * blocks,
+                            int size);
+static void move_blocks(Blocks * blocks, int to, int from, int size);
+static void run_parts(Level * lvl, int num_parts,
+                      void (*part) (void *arg, int i));
+static void count_part(void *arg, int i);
+static void expand_part(void *arg, int i);
+static int join_parts(Level * lvl, int num_parts);
+static void join_pieces(Context * ctx, int ind);
+static void start_piece(Part * part, int first);
+static void place_city(Context * ctx, Part * part, int ind, int city);
+static void close_piece(Context * ctx, Part * part, int first, int last);
+static int end_city(const Context * ctx, int ind);
+static void solve_leaf(Context * ctx, Part * part, unsigned int level,
+                       int lo, int hi, int start, int end, int ind);
+static void leaf_point(const Context * ctx, unsigned int level, int lo,
+                       int node, double *x, double *y);
 
 /*
  * Function which solves the Symmetric TSP by using renormalization technique
  */
 int    *
-renormalize()
+renormalize(Context * ctx, double *length)
 {
-   unsigned int     cells_x, cells_y;
-   int     t, l, unity;
+   Length  route_lngth = { 0, 0 };
 
-   int     start, end;
-   int     new_x, new_y;
-   int     location;
-   int     cells_v;
+   ctx->result = ctx->ws->route;
+   build_route(ctx, length != NULL ? &route_lngth : NULL, INFINITY,
+               MAX_LEVEL);
 
-   int     ind_x, ind_y;
+   if (length != NULL)
+      *length = total_length(&route_lngth);
 
-   grd    *grid;
+   ctx->result = NULL;
+   return ctx->ws->route;
+}
 
-   int     size = 256;
-   Block  *block_a = NULL;
-   Block  *block_b = NULL;
+double
+renormalize_energy(Context * ctx)
+{
+   return renormalize_bounded(ctx, INFINITY);
+}
 
-   Block  *block_new;
+double
+renormalize_bounded(Context * ctx, double limit)
+{
+   return renormalize_depth(ctx, MAX_LEVEL, limit);
+}
 
-   int     prev_is_a = 0;
+double
+renormalize_depth(Context * ctx, unsigned int depth, double limit)
+{
+   Length  route_lngth = { 0, 0 };
 
-   int     new_ind;
-   int     ind_city = 0;
+   /*
+    * A route is only cached with its cities.
+    */
+   ctx->result = use_cache(ctx, depth) ? ctx->ws->route : NULL;
+   build_route(ctx, &route_lngth, limit, depth);
 
-   Route  *route;
+   return total_length(&route_lngth);
+}
+
+/*
+ * Returns whether the complete routes of ctx are cached. The grid signature
+ * only determines a route when no leaves are solved: the path through a leaf
+ * depends on where its border points lie, which moves with the rotation
+ * itself.
+ */
+static int
+use_cache(const Context * ctx, unsigned int depth)
+{
+   return ctx->cache != NULL && ctx->leaf_cities < 2 && depth >= MAX_LEVEL;
+}
+
+/*
+ * Build the route for the rotation of ctx. The cities are stored in 
+ * ctx->result if it is not NULL, the length of the route is added to length
+ * if it is not NULL. If a lower bound on the length of the route exceeds
+ * limit the route is abandoned, and the bound is stored in length instead.
+ * After depth levels the blocks which are left are closed by close_blocks().
+ * A complete route is taken from the cache of ctx if it has the same grid
+ * signature, see grid_signature().
+ */
+static void
+build_route(Context * ctx, Length * length, double limit, unsigned int depth)
+{
+   int     t;
+   int     bounds[CELL_NODES + 1];
+
+   Workspace *ws = ctx->ws;
+   Level   lvl;
+   Blocks *block_swap;
+
+   int     prev_size;
+   int     num_parts;
+   double  bound;
+   double  cached;
+   uint64_t sign = 0;
+
+   /*
+    * The pieces of the route are not placed in order, the ends of the
+    * pieces show which neighbours of a piece are already placed.
+    */
+   ctx->length = length;
+   if (ctx->length != NULL && ++ws->stamp == 0) {
+      for (t = 0; t < ws->num_cities; t++)
+         ws->ends_stamp[t] = 0;
+      ws->stamp = 1;
+   }
+
+   sort_cities(ctx);
+
+   if (use_cache(ctx, depth)) {
+      sign = grid_signature(ctx, ctx->leaf_cities);
+      if ((cached = cache_find(ctx->cache, sign, ctx->result)) >= 0) {
+         if (ctx->length != NULL)
+            add_length(ctx->length, cached);
+         ctx->length = NULL;
+         return;
+      }
+   }
 
-   if ((_result = calloc(tsp->dimension, sizeof(int))) == NULL)
-      errx(EX_OSERR, "Out of memory!");
+   lvl.ctx = ctx;
+   lvl.block_prev = &ws->blocks[0];
+   lvl.block_new = &ws->blocks[1];
+   lvl.parts = ws->parts;
 
    /*
-    * Set up grid 
+    * It is the first iteration, so entry and deperature points in a
+    * block are not an issue yet and basic route can be used, unless the
+    * route is open.
     */
-   cells_x = 2;
-   cells_y = 2;
-   if ((block_a = realloc(block_a, size * sizeof(Block))) == NULL)
-      errx(EX_OSERR, "Out of memory!");
-   if ((block_b = realloc(block_b, size * sizeof(Block))) == NULL)
-      errx(EX_OSERR, "Out of memory!");
+   lvl.level = 1;
+   split_cell(ctx, lvl.level, 0, ws->num_cities, bounds);
+   lvl.block_prev->route[0] = (ctx->entry == NO_NODE) ?
+       get_basic_route(bitmask(bounds)) :
+       get_open_route(ctx->entry, ctx->departure, bitmask(bounds));
+   lvl.block_prev->lo[0] = 0;
+   lvl.block_prev->hi[0] = ws->num_cities;
+   lvl.block_prev->ind[0] = 0;
+
+   prev_size = 1;
 
    /*
     * Renormalize space until unity is reached. The renormalization procedure
@@ -86,1036 +180,664 @@ renormalize()
     * The space is divided into cells, the smaller the scale, the more cells.
     * For each cell there is checked if a city is within the cell. Now for each
     * block consisting of four cells the route is filled in. This route is
-    * optimal and should already be calculated by preprocess_routes.
+    * optimal and is taken from the table which is generated by mkroutes.
     * The previous iteration decides the entry and departure place of the block.
+    *
+    * Only the cells which still contain more than one city are refined. The 
+    * cities of the other cells are placed on the route directly, so the number
+    * of blocks in a level shrinks to the work which actually remains. A cell
+    * with at most ctx->leaf_cities cities is not refined either, the path
+    * through its cities is solved exactly by solve_leaf().
+    *
+    * The blocks of a level are split in parts of PART_BLOCKS blocks, which
+    * are expanded independently, on the threads of ctx->pool if it has any.
+    * The parts do not depend on the number of threads, so neither does the
+    * route or its length.
     */
-   unity = 0;
-   while (!unity) {
-      /*
-       * Generate Cartesian grid, should also be done by a help function
-       * (here for testing purposes)
-       */
-      grid = create_grd(&cells_x, &cells_y);
-      //printf("Iteration %d\n", cells_x);
-
-      /*
-       * Check if we are already at unity (At most one city in the block)
-       */
-      unity = 1;
-      for (ind_x = 0; ind_x < cells_x; ind_x++) {
-         for (ind_y = 0; ind_y < cells_y; ind_y++) {
-            if (has_city(grid, ind_x, ind_y) == MANY_CITIES)
-               unity = 0;
-         }
+   while (prev_size > 0) {
+      num_parts = (prev_size + PART_BLOCKS - 1) / PART_BLOCKS;
+      for (t = 0; t < num_parts; t++) {
+         lvl.parts[t].first = t * PART_BLOCKS;
+         lvl.parts[t].last = (t + 1 < num_parts) ? (t + 1) * PART_BLOCKS :
+             prev_size;
       }
 
       /*
-       * It is the first iteration, so entry and deperature points in a
-       * block are not an issue yet and basic route can be used
+       * Every new block holds at least two cities, so the number of crowded
+       * subcells of a part bounds the number of blocks it makes. A prefix 
+       * sum over these bounds gives every part its own range of new blocks.
        */
-      if (cells_x == 2) {
-         cells_v = bitmask(grid, 0, 0);
-         block_a[0].route = get_basic_route(cells_v);
-         block_a[0].x = 0;
-         block_a[0].y = 0;
+      run_parts(&lvl, num_parts, count_part);
+      for (t = 0; t < num_parts; t++)
+         lvl.parts[t].offset = (t == 0) ? 0 :
+             lvl.parts[t - 1].offset + lvl.parts[t - 1].size;
+      assert(num_parts == 0 || lvl.parts[num_parts - 1].offset +
+             lvl.parts[num_parts - 1].size <= ws->max_blocks);
+
+      run_parts(&lvl, num_parts, expand_part);
+
+      prev_size = join_parts(&lvl, num_parts);
 
-         block_a[1].route = NULL;
       /*
-       * Else we have entry and departure points for the blocks
+       * The edges between the cities which are placed are final, and the
+       * cities of every new block are still to be connected, unless the
+       * blocks are closed at this depth.
        */
-      } else {
-         new_ind = 0;
-         /*
-          * The blocks are stored in a sparse way and in the order of the route
-          * So traverse the route of the previous iteration to find the entry 
-          * and departue points in the new block
-          */
-         for (t = 0; t < size; t++) {
-            /*
-             * Check which array is the previous iteration, and which is the
-             * new one
-             */ 
-            if (prev_is_a) {
-               route = block_a[t].route;
-               block_new = &(block_b[new_ind]);
-            } else {
-               route = block_b[t].route;
-               block_new = &(block_a[new_ind]);
-            }
-
-            /*
-             * End of the route is shown by a NULL pointer in the route block
-             */
-            if (!route) {
-               if (!unity)
-                  block_new->route = NULL;//Signal end of path
-               break;
-            }
-            
-            /* 
-             * Traverse all visited subcells in the block of the previous 
-             * iteration
-             */
-            for (l = 0; l < CELL_NODES; l++) {
-               if (prev_is_a) {
-                  new_x = 2 * block_a[t].x;
-                  new_y = 2 * block_a[t].y;
-
-                  block_new = &(block_b[new_ind]);
-               } else {
-                  new_x = 2 * block_b[t].x;
-                  new_y = 2 * block_b[t].y;
-
-                  block_new = &(block_a[new_ind]);
-               }
-
-               /*
-                * -1 is the end of the route through the block
-                */
-               location = route->visits[l];
-               if (location == -1)
-                  break;
-
-               /*
-                * Calculate new (x, y) location
-                */
-               if (location % 2)
-                  new_x++;
-               if (location > 1)
-                  new_y++;
-
-               /*
-                * Check which subcells are visited
-                */
-               cells_v = bitmask(grid, new_x * 2, new_y * 2);
-               
-               /*
-                * If there are no cities in the block it is useless to go to 
-                * a smaller scale for this block
-                */
-               if(!cells_v)
-                   continue;
-
-               /*
-                * Get the start and endpoint in this subcell
-                */
-               start = route->start[location];
-               end = route->end[location];
-
-               assert(start != -1 && end != -1);
-
-               /*
-                * Get precomputed shortest route
-                */
-               block_new->route =
-                   _shortest_routes[start - CELL_NODES][end - CELL_NODES]
-                   [cells_v];
-               block_new->x = new_x;
-               block_new->y = new_y;
-
-               /*
-                * Also store the visited cities in the last iteration
-                */
-               if (unity)
-                  map_block_on_route(block_new, grid, &ind_city);
-
-               /*
-                * Update index in the block, if needed increase size of array
-                */
-               new_ind++;
-               if (new_ind >= size) {
-                  size *= 2;
-                  if ((block_a =
-                       realloc(block_a, size * sizeof(Block))) == NULL)
-                     errx(EX_OSERR, "Out of memory!");
-                  if ((block_b =
-                       realloc(block_b, size * sizeof(Block))) == NULL)
-                     errx(EX_OSERR, "Out of memory!");
-               }
-            }
+      if (ctx->length != NULL && limit < INFINITY && prev_size > 0) {
+         bound = total_length(ctx->length);
+         if (depth >= MAX_LEVEL)
+            bound += pending_bound(ctx, lvl.block_new, prev_size);
+         if (bound > limit) {
+            ctx->length->sum = bound;
+            ctx->length->comp = 0;
+            break;
          }
       }
+
+      if (depth < MAX_LEVEL && lvl.level >= depth && prev_size > 0) {
+         close_blocks(ctx, lvl.block_new, prev_size);
+         break;
+      }
+      if (prev_size == 0)
+         ctx->levels = lvl.level;
+
       /*
        * Store iteration 
        */
 /*        char name[32];
-        sprintf(name, "/tmp/it%d", cells_x);
+        sprintf(name, "/tmp/it%d", 2 << lvl.level);
         FILE* f = fopen(name, "w");
-        if (prev_is_a)
-            print_routes(block_b, size, f);
-        else
-            print_routes(block_a, size, f);
+        print_routes(ctx, lvl.block_new, lvl.level, prev_size, f);
         fclose(f);*/
       /*
        * Change previous block
        */
-      prev_is_a = !prev_is_a;
-      
-      /*
-       * Empty grid
-       */
-      free_grd(grid);
-      grid = NULL;
+      block_swap = lvl.block_prev;
+      lvl.block_prev = lvl.block_new;
+      lvl.block_new = block_swap;
 
-      /*
-       * Increase number of cells
-       */
-      cells_x *= 2;
-      cells_y *= 2;
+      lvl.level++;
    }
 
-   free(block_a);
-   free(block_b);
-   return _result;
-}
+   if (use_cache(ctx, depth) && prev_size == 0 && ctx->length != NULL &&
+       ctx->result != NULL)
+      cache_store(ctx->cache, sign, total_length(ctx->length), ctx->result);
 
-void
-map_block_on_route(Block * block, grd * grid, int *ind)
-{
-   int     i;
-   int     ind_x = block->x;
-   int     ind_y = block->y;
-
-   for (i = 0; i < block->route->trace_length; i++) {
-      switch (block->route->trace[i]) {
-      case NODE_CELL_TL:
-         if (has_city(grid, 2 * ind_x, 2 * ind_y) != NO_CITY) {
-            _result[*ind] = has_city(grid, 2 * ind_x, 2 * ind_y);
-            *ind = *ind + 1;
-         }
-         break;
-      case NODE_CELL_TR:
-         if (has_city(grid, 2 * ind_x + 1, 2 * ind_y) != NO_CITY) {
-            _result[*ind] = has_city(grid, 2 * ind_x + 1, 2 * ind_y);
-            *ind = *ind + 1;
-         }
-         break;
-      case NODE_CELL_BL:
-         if (has_city(grid, 2 * ind_x, 2 * ind_y + 1) != NO_CITY) {
-            _result[*ind] = has_city(grid, 2 * ind_x, 2 * ind_y + 1);
-            *ind = *ind + 1;
-         }
-         break;
-      case NODE_CELL_BR:
-         if (has_city(grid, 2 * ind_x + 1, 2 * ind_y + 1) != NO_CITY) {
-            _result[*ind] = has_city(grid, 2 * ind_x + 1, 2 * ind_y + 1);
-            *ind = *ind + 1;
-         }
-         break;
-      }
-   }
+   ctx->length = NULL;
 }
 
 /*
- * Convert visited cells into a bitmask
+ * Close the route at the blocks, every block is replaced by its first city
+ * as one piece of the route. The length of the edges between the pieces is
+ * added to the length of the route.
  */
-int
-bitmask(grd * grid, int ind_x, int ind_y)
+static void
+close_blocks(Context * ctx, const Blocks * blocks, int size)
 {
-   int     mask = 0;
+   Part    part = { 0 };
 
-   if (has_city(grid, ind_x, ind_y) != NO_CITY)
-      mask |= BIT_CELL_TL;
-   if (has_city(grid, ind_x + 1, ind_y) != NO_CITY)
-      mask |= BIT_CELL_TR;
-   if (has_city(grid, ind_x, ind_y + 1) != NO_CITY)
-      mask |= BIT_CELL_BL;
-   if (has_city(grid, ind_x + 1, ind_y + 1) != NO_CITY)
-      mask |= BIT_CELL_BR;
-   return mask;
+   if (ctx->length == NULL)
+      return;
+
+   part.hi = ctx->ws->num_cities;
+   for (int t = 0; t < size; t++) {
+      start_piece(&part, blocks->ind[t]);
+      place_city(ctx, &part, blocks->ind[t],
+                 sorted_city(ctx, blocks->lo[t]));
+      close_piece(ctx, &part, blocks->ind[t],
+                  blocks->ind[t] + blocks->hi[t] - blocks->lo[t]);
+   }
+   add_length(ctx->length, part.length.sum);
+   add_length(ctx->length, part.length.comp);
 }
 
 /*
- * Get the basic route. A basic route is a case where no entry point and
- * departure point are specified on the edge of the square. For each cell
- * is specified if it needs to be visited or not using the arguments.
- * The basic route is a closed path connecting the selected points
+ * Returns a lower bound on the length of the edges between the cities of 
+ * the blocks. The cities of a block are adjacent on the route, so the path
+ * through them is at least as long as the distance between its first and 
+ * its last city.
  */
-Route  *
-get_basic_route(int cells)
+static double
+pending_bound(const Context * ctx, const Blocks * blocks, int size)
 {
-   int     i;
-   int     previous_point = -1;
-
-   if (!_basic_start) {
-      if ((_basic_start = calloc(1, sizeof(Route))) == NULL)
-         errx(EX_OSERR, "Out of memory!");
-   } else {
-      _basic_start->trace_length = 0;
-      _basic_start->length = 0.0;
-
-      for (i = 0; i < CELL_NODES; i++) {
-         _basic_start->visits[i] = -1;
-         _basic_start->start[i] = -1;
-         _basic_start->end[i] = -1;
-      }
+   Length  bound = { 0, 0 };
 
-      for (i = 0; i < NODES; i++)
-         _basic_start->trace[i] = -1;
-   }
-
-   /*
-    * Simply visit all cells and you have already the shortest path 
-    */
-   if (cells & BIT_CELL_TL) {
-      _basic_start->trace[_basic_start->trace_length] = NODE_CELL_TL;
-      _basic_start->trace_length++;
-
-      previous_point = NODE_CELL_TL;
-   }
-   if (cells & BIT_CELL_TR) {
-      if (previous_point != -1) {
-         _basic_start->trace[_basic_start->trace_length] =
-             point_on_edge(previous_point, NODE_CELL_TR);
-         _basic_start->trace_length++;
-      }
-      _basic_start->trace[_basic_start->trace_length] = NODE_CELL_TR;
-      _basic_start->trace_length++;
-
-      previous_point = NODE_CELL_TR;
-   }
-   if (cells & BIT_CELL_BR) {
-      if (previous_point != -1) {
-         _basic_start->trace[_basic_start->trace_length] =
-             point_on_edge(previous_point, NODE_CELL_BR);
-         _basic_start->trace_length++;
-      }
-      _basic_start->trace[_basic_start->trace_length] = NODE_CELL_BR;
-      _basic_start->trace_length++;
-
-      previous_point = NODE_CELL_BR;
-   }
-   if (cells & BIT_CELL_BL) {
-      if (previous_point != -1) {
-         _basic_start->trace[_basic_start->trace_length] =
-             point_on_edge(previous_point, NODE_CELL_BL);
-         _basic_start->trace_length++;
-      }
-      _basic_start->trace[_basic_start->trace_length] = NODE_CELL_BL;
-      _basic_start->trace_length++;
-   }
-   /*
-    * Repeat last node to close the path (If the path is longer than two) and
-    * set start and endpoints in subblock
-    */
-   if (_basic_start->trace_length > 3) {
-      previous_point =
-          point_on_edge(_basic_start->trace[_basic_start->
-                                            trace_length - 1],
-                        _basic_start->trace[0]);
-
-      for (i = _basic_start->trace_length; i > 0; i--)
-         _basic_start->trace[i] = _basic_start->trace[i - 1];
-      _basic_start->trace_length++;
-
-      _basic_start->trace[0] = previous_point;
-      _basic_start->trace[_basic_start->trace_length] = previous_point;
-      _basic_start->trace_length++;
-
-      set_borderpoints_subblocks(_basic_start);
-   } else {
-      errx(EX_DATAERR, "Try other grid range!\n");
-   }
-   return _basic_start;
+   for (int t = 0; t < size; t++)
+      add_length(&bound, city_distance(ctx->tsp,
+                                       sorted_city(ctx, blocks->lo[t]),
+                                       sorted_city(ctx, blocks->hi[t] - 1)));
+   return total_length(&bound);
 }
 
 /*
- * Initialize weight matrix of the default graph
- * Function is needed because this can not be done statically
+ * Run the function for every part of a level, on the threads of the pool of
+ * the context if there is more than one part.
  */
-void
-make_weight_matrix()
+static void
+run_parts(Level * lvl, int num_parts, void (*part) (void *arg, int i))
 {
-   int     i, j;
-   /* Initialize default on zero. */
-   for (i = 0; i < NORMAL_NODES; i++)
-      for (j = 0; j < NORMAL_NODES; j++)
-         _weights[i][j] = 0.0;
-
-   _weights[NODE_BORDER_TL][NODE_CELL_TL] = 0.707;
-
-   _weights[NODE_BORDER_T][NODE_CELL_TL] = 0.707;
-   _weights[NODE_BORDER_T][NODE_CELL_TR] = 0.707;
-
-   _weights[NODE_BORDER_TR][NODE_CELL_TR] = 0.707;
-
-   _weights[NODE_BORDER_L][NODE_CELL_TL] = 0.707;
-   _weights[NODE_BORDER_L][NODE_CELL_BL] = 0.707;
-
-   _weights[NODE_BORDER_R][NODE_CELL_TR] = 0.707;
-   _weights[NODE_BORDER_R][NODE_CELL_BR] = 0.707;
-
-   _weights[NODE_BORDER_BL][NODE_CELL_BL] = 0.707;
-
-   _weights[NODE_BORDER_B][NODE_CELL_BR] = 0.707;
-   _weights[NODE_BORDER_B][NODE_CELL_BL] = 0.707;
-
-   _weights[NODE_BORDER_BR][NODE_CELL_BR] = 0.707;
-
-   _weights[NODE_CELL_TL][NODE_CELL_TR] = 1.0;
-   _weights[NODE_CELL_TL][NODE_CELL_BL] = 1.0;
-   _weights[NODE_CELL_TL][NODE_CELL_BR] = 1.414;
-   _weights[NODE_CELL_TL][NODE_BORDER_TL] = 0.707;
-   _weights[NODE_CELL_TL][NODE_BORDER_T] = 0.707;
-   _weights[NODE_CELL_TL][NODE_BORDER_L] = 0.707;
-
-   _weights[NODE_CELL_TR][NODE_CELL_TL] = 1.0;
-   _weights[NODE_CELL_TR][NODE_CELL_BR] = 1.0;
-   _weights[NODE_CELL_TR][NODE_CELL_BL] = 1.414;
-   _weights[NODE_CELL_TR][NODE_BORDER_TR] = 0.707;
-   _weights[NODE_CELL_TR][NODE_BORDER_T] = 0.707;
-   _weights[NODE_CELL_TR][NODE_BORDER_R] = 0.707;
-
-   _weights[NODE_CELL_BL][NODE_CELL_BR] = 1.0;
-   _weights[NODE_CELL_BL][NODE_CELL_TL] = 1.0;
-   _weights[NODE_CELL_BL][NODE_CELL_TR] = 1.414;
-   _weights[NODE_CELL_BL][NODE_BORDER_BL] = 0.707;
-   _weights[NODE_CELL_BL][NODE_BORDER_B] = 0.707;
-   _weights[NODE_CELL_BL][NODE_BORDER_L] = 0.707;
-
-   _weights[NODE_CELL_BR][NODE_CELL_BL] = 1.0;
-   _weights[NODE_CELL_BR][NODE_CELL_TR] = 1.0;
-   _weights[NODE_CELL_BR][NODE_CELL_TL] = 1.414;
-   _weights[NODE_CELL_BR][NODE_BORDER_BR] = 0.707;
-   _weights[NODE_CELL_BR][NODE_BORDER_B] = 0.707;
-   _weights[NODE_CELL_BR][NODE_BORDER_R] = 0.707;
+   if (lvl->ctx->pool != NULL && num_parts > 1)
+      pool_run(lvl->ctx->pool, num_parts, part, lvl);
+   else
+      for (int i = 0; i < num_parts; i++)
+         part(lvl, i);
 }
 
 /*
- * Calculate all shortest routes for the default graph(See top of this file).
- * Here difference is made for the cells which are visited. For all
- * the nodes shortest paths are calculated for every possible combination of
- * cells which need to be visited. The visited cells are encoded using bitmasks,
- * for making the iteration more simple.
+ * Count the subcells of the blocks of part i which hold more than one city,
+ * and find the indices of the route which the part covers.
  */
-void
-preprocess_routes()
+static void
+count_part(void *arg, int i)
 {
-   int     cells;
-   int     start, end;
-   int     i, j;
-   int     paths_possible;
-   int     visit_topleft, visit_topright;
-   int     visit_bottomleft, visit_bottomright;
-   int     is_shorter;
-   Route_array path;
-   Route  *shortest;
-
-   make_weight_matrix();
-
-   /*
-    * Iterate over all start and endpoints in the graph 
-    */
-   for (start = 0; start < BORDER_NODES; start++) {
-      for (end = 0; end < BORDER_NODES; end++) {
-         path = paths(start + CELL_NODES, end + CELL_NODES, 0);
-
-         /*
-          * Decide for each possible combination of visited cells, what the
-          * shortest route is
-          */
-         for (cells = 0; cells < BIT_CELL_MAX; cells++) {
-            shortest = NULL;
-            for (i = 0; i < path.size; i++) {
-               if (route_visits_cells(path.routes[i], cells)) {
-                  if (shortest == NULL)
-                     shortest = path.routes[i];
-                  else if (path.routes[i]->length < shortest->length)
-                     shortest = path.routes[i];
-               }
-            }
-            if (!shortest)
-               _shortest_routes[start][end][cells] = NULL;
-            else {
-               _shortest_routes[start][end][cells] = copy_route(shortest);
-                
-               set_borderpoints_subblocks(_shortest_routes[start][end]
-                                          [cells]);
-            }
-         }
-         for (i = 0; i < path.size; i++)
-            free(path.routes[i]);
-         free(path.routes);
-      }
+   Level  *lvl = arg;
+   Part   *part = &lvl->parts[i];
+   const Blocks *prev = lvl->block_prev;
+   int     last = part->last - 1;
+   int     bounds[CELL_NODES + 1];
+
+   part->size = 0;
+   for (int t = part->first; t < part->last; t++) {
+      split_cell(lvl->ctx, lvl->level, prev->lo[t], prev->hi[t], bounds);
+      for (int l = 0; l < CELL_NODES; l++)
+         if (bounds[l + 1] - bounds[l] > 1)
+            part->size++;
    }
+
+   part->lo = prev->ind[part->first];
+   part->hi = prev->ind[last] + prev->hi[last] - prev->lo[last];
+   part->length.sum = 0;
+   part->length.comp = 0;
+   part->skip_lo = 0;
+   part->skip_hi = 0;
 }
 
 /*
- * Free the precalculated routes
+ * Expand the blocks of part i in the blocks of the next level, which are 
+ * stored from the offset of the part. The size of the part becomes the
+ * number of new blocks.
  */
-void
-free_routes()
+static void
+expand_part(void *arg, int i)
 {
+   Level  *lvl = arg;
+   Context *ctx = lvl->ctx;
+   Part   *part = &lvl->parts[i];
+   const Blocks *block_prev = lvl->block_prev;
+   Blocks  block_new = {
+      lvl->block_new->route + part->offset,
+      lvl->block_new->lo + part->offset,
+      lvl->block_new->hi + part->offset,
+      lvl->block_new->ind + part->offset
+   };
+   unsigned int level = lvl->level;
+   int     t, l;
+
    int     start, end;
-   int     cells;
+   int     location;
+   int     cells_v;
+   int     id;
+   int     bounds[CELL_NODES + 1];
+   int     sub_bounds[CELL_NODES + 1];
+   int     sub_cities;
 
-   /*
-    * Iterate over all start and endpoints in the graph 
-    */
-   for (start = 0; start < BORDER_NODES; start++)
-      for (end = 0; end < BORDER_NODES; end++)
-         for (cells = 0; cells < BIT_CELL_MAX; cells++)
-            if (_shortest_routes[start][end][cells])
-               free(_shortest_routes[start][end]
-                    [cells]);
-}
+   int     new_ind = 0;
+   int     ind_city;
 
-/*
- * Finds entry and departure blocks in one route block
- * These are the start and end points of routes through the subcells 
- * of this block
- */
-void
-set_borderpoints_subblocks(Route * route)
-{
-   int     i;
-   int     start_cur, end_cur;
-   int     visits_no = 0;
-   int     cell_a, cell_b;
-   int     has_start = 0;
-   int     alternative[CELL_NODES];
-   int     location[CELL_NODES];
-
-   if (!route)
-      return;
+   const Route *route;
 
    /*
-    * Initialize fields
-    */
-   for (i = 0; i < CELL_NODES; i++) {
-      route->visits[i] = -1;
-      route->start[i] = -1;
-      route->end[i] = -1;
-   }
-   
-   /*
-    * Walk through the total trace
+    * The blocks are stored in the order of the route, so traverse the
+    * route of the previous iteration to find the entry and departure
+    * points in the new blocks
     */
-   for (i = 0; i < route->trace_length; i++) {
-       /* Check if we are at the border of a cell*/
-      if (route->trace[i] >= NODE_CELL_TL && route->trace[i] <= NODE_CELL_BR)
-         continue;
+   for (t = part->first; t < part->last; t++) {
+      route = id_route(block_prev->route[t]);
+      ind_city = block_prev->ind[t];
+
+      split_cell(ctx, level, block_prev->lo[t], block_prev->hi[t], bounds);
 
       /*
-       * Set start of route through the subcell
+       * Traverse all visited subcells in the block of the previous 
+       * iteration
        */
-      if (!has_start) {
-         start_cur = i;
-         has_start = 1;
-      } else {
+      for (l = 0; l < CELL_NODES; l++) {
          /*
-          * Get number of the cell through which the subpath is traversing 
-          */ 
-         end_cur = i;
-         get_cell_index(route, start_cur, end_cur, &cell_a, &cell_b);
+          * NO_NODE is the end of the route through the block
+          */
+         location = route->visits[l];
+         if (location == NO_NODE)
+            break;
 
          /*
-          * If in this subcell no path is stored, store it here by choosing
-          * the first or second subcell
+          * If there are no cities in the block it is useless to go to 
+          * a smaller scale for this block, and a single city can be 
+          * placed on the route right away.
           */
-         if (route->start[cell_a] == -1) {
-            route->start[cell_a] = route->trace[start_cur];
-            route->end[cell_a] = route->trace[end_cur];
-
-            location[cell_a] = visits_no;
-            alternative[cell_a] = cell_b;
+         sub_cities = bounds[location + 1] - bounds[location];
+         if (sub_cities == 0)
+            continue;
+         if (sub_cities == 1) {
+            start_piece(part, ind_city);
+            place_city(ctx, part, ind_city,
+                       sorted_city(ctx, bounds[location]));
+            close_piece(ctx, part, ind_city, ind_city + 1);
+            ind_city++;
+            continue;
+         }
 
-            visits_no++;
-         } else if (route->start[cell_b] == -1) {
-            route->start[cell_b] = route->trace[start_cur];
-            route->end[cell_b] = route->trace[end_cur];
+         /*
+          * Get the start and endpoint in this subcell
+          */
+         start = route->start[location];
+         end = route->end[location];
 
-            location[cell_a] = visits_no;
-            alternative[cell_b] = cell_b;
+         assert(start != NO_NODE && end != NO_NODE);
 
-            visits_no++;
          /*
-          * Otherwise, the cell we chose in the first hand was incorrect
-          * and we need to take the alternative cell found by get_cell_index
+          * A cell with few cities is finished by solving the path through
+          * them exactly, instead of refining it further.
           */
-         } else if (alternative[cell_a]) {
-            route->start[alternative[cell_a]] = route->start[cell_a];
-            route->end[alternative[cell_a]] = route->end[cell_a];
+         if (sub_cities <= ctx->leaf_cities) {
+            solve_leaf(ctx, part, level, bounds[location],
+                       bounds[location + 1], start, end, ind_city);
+            ind_city += sub_cities;
+            continue;
+         }
 
-            location[alternative[cell_a]] = location[cell_a];
+         if (level == MAX_LEVEL)
+            errx(EX_DATAERR, "Cities are too close to be separated");
 
-            route->start[cell_a] = route->trace[start_cur];
-            route->end[cell_a] = route->trace[end_cur];
+         /*
+          * Check which subcells are visited
+          */
+         split_cell(ctx, level + 1, bounds[location], bounds[location + 1],
+                    sub_bounds);
+         cells_v = bitmask(sub_bounds);
 
-            location[cell_a] = visits_no;
-            visits_no++;
-         } else if (alternative[cell_b]) {
-            route->start[alternative[cell_b]] = route->start[cell_b];
-            route->end[alternative[cell_b]] = route->end[cell_b];
+         /*
+          * Get precomputed shortest route
+          */
+         id = route_id(start, end, cells_v);
+         assert(id_route(id)->trace_length != 0);
 
-            location[alternative[cell_b]] = location[cell_b];
+         /*
+          * If none of the subcells hold more than one city the block is
+          * finished at this level.
+          */
+         if (max_cities(sub_bounds) == 1) {
+            map_block_on_route(ctx, part, id_route(id), ind_city,
+                               sub_bounds);
+            ind_city += sub_cities;
+            continue;
+         }
 
-            route->start[cell_b] = route->trace[start_cur];
-            route->end[cell_b] = route->trace[end_cur];
+         assert(new_ind < part->size);
+         block_new.route[new_ind] = id;
+         block_new.lo[new_ind] = bounds[location];
+         block_new.hi[new_ind] = bounds[location + 1];
+         block_new.ind[new_ind] = ind_city;
 
-            location[cell_b] = visits_no;
-            visits_no++;
-         }
-         start_cur = end_cur;
+         ind_city += sub_cities;
+         new_ind++;
       }
    }
 
-   /*
-    * Set borderpoints in subcells and store the order in which the subcells 
-    * are visited
-    */
-   for (i = 0; i < CELL_NODES; i++) {
-      route->start[i] = convert_node(i, route->start[i]);
-      route->end[i] = convert_node(i, route->end[i]);
-
-      if (route->start[i] != -1 && route->end[i] != -1)
-         route->visits[location[i]] = i;
-   }
+   part->size = new_ind;
 }
 
 /*
- * Function giving all possible paths between start and end, which visit each
- * node maximal one time. It results a list of pointers to the found routes
+ * Move the new blocks of the parts together, and add the lengths of the
+ * parts and the edges between them to the length of the route. Returns the
+ * number of new blocks.
  */
-Route_array
-paths(int start, int end, int visited)
+static int
+join_parts(Level * lvl, int num_parts)
 {
-   Route_array routes_new;
-   Route_array routes_cur;
-   Route  *route;
-   int     paths_previous_no, i, j, k;
-   int     node_between;
-   int     diff;
+   Context *ctx = lvl->ctx;
+   Part   *parts = lvl->parts;
+   int     num_cities = ctx->ws->num_cities;
+   int     size = 0;
+
+   for (int i = 0; i < num_parts; i++) {
+      if (parts[i].offset != size)
+         move_blocks(lvl->block_new, size, parts[i].offset, parts[i].size);
+      size += parts[i].size;
+   }
 
-   routes_new.routes = NULL;
-   routes_new.size = 0;
+   if (ctx->length == NULL)
+      return size;
+
+   for (int i = 0; i < num_parts; i++) {
+      add_length(ctx->length, parts[i].length.sum);
+      add_length(ctx->length, parts[i].length.comp);
+   }
 
    /*
-    * Function wants all the routes with the same start and endpoint for
-    * calculating the shortest path, Normally you would aspect that this path
-    * has a length of 0 (Stay at the location). However maybe he needs to
-    * visit some cells
+    * An edge to a piece outside the part is left to this point, since the
+    * piece may be placed by another part at the same time. Neighbouring 
+    * parts may both have left the same edge, it is added once.
     */
-   if (start == end && visited == 0) {
-      /*
-       * Find edges out of the start point. Use the destination of these
-       * edge as a start point for a route to our endpoint, refuse routes
-       * which use the same edge we have selected, since it is not allowed
-       * to use an edge twice
-       */
-      for (i = 0; i < NORMAL_NODES; i++) {
-         if (_weights[i][end]) {
-            routes_cur = paths(i, end, 0);
-            node_between = point_on_edge(i, end);
-
-            for (j = 0; j < routes_cur.size; j++) {
-               route = routes_cur.routes[j];
-
-               /*
-                * Route is one edge long uses this discovered edge 
-                */
-               if (route->trace_length == 2) {
-                  free(route);
-                  continue;
-               } else if (route->trace_length == 3 &&
-                          route->trace[0] == start &&
-                          route->trace[1] ==
-                          node_between && route->trace[2] == i) {
-                  free(route);
-                  continue;
-               }
-               diff = node_between == -1 ? 1 : 2;
-
-               /*
-                * Put our startpoint in front again to make round tour 
-                */
-               for (k = route->trace_length; k > diff - 1; k--)
-                  route->trace[k] = route->trace[k - diff];
-
-               route->trace[0] = start;
-               route->trace_length++;
-               route->length += _weights[start][i];
-
-               if (node_between != -1) {
-                  route->trace[1] = node_between;
-                  route->trace_length++;
-               }
-               add_route(&routes_new, route);
-            }
-            free(routes_cur.routes);
-         }
-      }
-   } else if (start == end) {
-      /*
-       * Base case: all paths from a point to itself. Since we are
-       * eventually interested in shortest paths, there is actually one path
-       * (stay at your location)
-       */
-      if ((route = calloc(1, sizeof(Route))) == NULL)
-         errx(EX_OSERR, "Out of memory");
-
-      route->trace[0] = start;
-      route->trace_length = 1;
-      route->length = 0.0;
-      add_route(&routes_new, route);
-   } else {
-      /*
-       * For getting all possible paths you search all connected neighbours.
-       * From here the paths are recursively determined. Now you only need
-       * to add this current point to the trace. Do not visit neighbours
-       * which are already visited in the current route, since this would
-       * produce cycles in the route
-       */
-      for (i = 0; i < NORMAL_NODES; i++) {
-         if (_weights[i][end] && !(visited & (1 << i))) {
-            routes_cur = paths(start, i, visited | (1 << end));
-            node_between = point_on_edge(i, end);
-
-            for (j = 0; j < routes_cur.size; j++) {
-               route = routes_cur.routes[j];
-
-               /*
-                * Edge this edge to the route (With the node in between) 
-                */
-               if (node_between != -1) {
-                  route->trace[route->trace_length] = node_between;
-                  route->trace_length++;
-               }
-               route->trace[route->trace_length] = end;
-               route->trace_length++;
-               route->length += _weights[i][end];
-
-               add_route(&routes_new, route);
-            }
-            free(routes_cur.routes);
-         }
-      }
+   for (int i = 0; i < num_parts; i++) {
+      if (parts[i].skip_lo && !(i > 0 && parts[i - 1].skip_hi &&
+                                parts[i - 1].hi % num_cities == parts[i].lo))
+         join_pieces(ctx, parts[i].lo);
+      if (parts[i].skip_hi && !(i == num_parts - 1 && parts[0].skip_lo &&
+                                parts[i].hi % num_cities == parts[0].lo))
+         join_pieces(ctx, parts[i].hi % num_cities);
    }
-   return routes_new;
+
+   return size;
 }
 
 /*
- * Add a route to a route array.
- * Herefore the allocated size of the array is increased
+ * Add the edge between the indices ind - 1 and ind of the route, if the 
+ * pieces at both sides are placed.
  */
-void
-add_route(Route_array * array, Route * route)
+static void
+join_pieces(Context * ctx, int ind)
 {
-   assert(array);
-
-   array->size++;
-   array->routes = realloc(array->routes, array->size * sizeof(Route *));
+   int     prev = end_city(ctx, (ind == 0) ? ctx->ws->num_cities - 1 : ind - 1);
+   int     next = end_city(ctx, ind);
 
-   if (array->routes == NULL)
-      errx(EX_OSERR, "Out of memory");
+   if (prev != NO_CITY && next != NO_CITY)
+      add_length(ctx->length, city_distance(ctx->tsp, prev, next));
+}
 
-   array->routes[array->size - 1] = route;
+/*
+ * Start a new piece of the route at index first.
+ */
+static void
+start_piece(Part * part, int first)
+{
+   part->piece_start = first;
 }
 
 /*
- *  Copy a route
+ * Place a city on the route at index ind, which is the next index of the
+ * current piece.
  */
-Route  *
-copy_route(Route * src)
+static void
+place_city(Context * ctx, Part * part, int ind, int city)
 {
-   int     i;
-   Route  *dest;
+   if (ctx->result != NULL)
+      ctx->result[ind] = city;
 
-   if ((dest = calloc(1, sizeof(Route))) == NULL)
-      errx(EX_OSERR, "Out of memory");
+   if (ctx->length == NULL)
+      return;
 
-   for (i = 0; i < NODES; i++)
-      dest->trace[i] = src->trace[i];
+   if (ind == part->piece_start)
+      part->piece_first = city;
+   else
+      add_length(&part->length,
+                 city_distance(ctx->tsp, part->piece_last, city));
+   part->piece_last = city;
+}
 
-   dest->trace_length = src->trace_length;
-   dest->length = src->length;
+/*
+ * A piece of the route, from index first up to last, has been placed. The
+ * edges in the piece are already added to the length of the route, an edge
+ * to a neighbouring piece is added by the piece which is placed last. So the
+ * route never has to be walked again to compute its length. An edge to a 
+ * piece outside the part is left to join_parts().
+ */
+static void
+close_piece(Context * ctx, Part * part, int first, int last)
+{
+   Workspace *ws = ctx->ws;
+   int     num_cities = ws->num_cities;
+   int     prev, next;
 
-   for (i = 0; i < CELL_NODES; i++) {
-      dest->visits[i] = src->visits[i];
-      dest->start[i] = src->start[i];
-      dest->end[i] = src->end[i];
+   if (ctx->length == NULL)
+      return;
+
+   /*
+    * A piece which holds all the cities closes the route itself.
+    */
+   if (last - first == num_cities) {
+      add_length(&part->length, city_distance(ctx->tsp, part->piece_last,
+                                              part->piece_first));
+      return;
    }
 
-   return dest;
+   prev = (first == 0) ? num_cities - 1 : first - 1;
+   next = (last == num_cities) ? 0 : last;
+
+   if (prev < part->lo || prev >= part->hi)
+      part->skip_lo = 1;
+   else if ((prev = end_city(ctx, prev)) != NO_CITY)
+      add_length(&part->length, city_distance(ctx->tsp, prev,
+                                              part->piece_first));
+   if (next < part->lo || next >= part->hi)
+      part->skip_hi = 1;
+   else if ((next = end_city(ctx, next)) != NO_CITY)
+      add_length(&part->length, city_distance(ctx->tsp, part->piece_last,
+                                              next));
+
+   /*
+    * The cities at both ends of the pieces are only valid if their stamp is
+    * the stamp of the current route, so they never have to be cleared.
+    */
+   ws->ends[first] = part->piece_first;
+   ws->ends_stamp[first] = ws->stamp;
+   ws->ends[last - 1] = part->piece_last;
+   ws->ends_stamp[last - 1] = ws->stamp;
 }
 
 /*
- * Check if a specific node is in the route
+ * Returns the city at index ind if it is the end of a piece which is 
+ * already placed, NO_CITY otherwise.
  */
-int
-node_in_route(int node, Route * route)
+static int
+end_city(const Context * ctx, int ind)
 {
-   int     i;
-
-   if (!route)
-      return 0;
-
-   for (i = 0; i < route->trace_length; i++)
-      if (route->trace[i] == node)
-         return 1;
-
-   return 0;
+   if (ctx->ws->ends_stamp[ind] != ctx->ws->stamp)
+      return NO_CITY;
+   return ctx->ws->ends[ind];
 }
 
 /*
- * Check if the route is valid and visits the cells specified in
- * the bitmask <cells>
+ * Place the cities lo up to hi, which form one cell at level, on the route 
+ * from index ind on. The route enters the cell at its border point start and
+ * leaves it at end, in between it takes the shortest path through the cities,
+ * which is found with dynamic programming over the sets of cities, as in the
+ * Held-Karp algorithm.
  */
-int
-route_visits_cells(Route * route, int cells)
+static void
+solve_leaf(Context * ctx, Part * part, unsigned int level, int lo, int hi,
+           int start, int end, int ind)
 {
-   if (BIT_CELL_TL & cells && !node_in_route(NODE_CELL_TL, route))
-      return 0;
+   double  cost[1 << LEAF_MAX][LEAF_MAX];
+   int8_t  prev[1 << LEAF_MAX][LEAF_MAX];
+   int     city[LEAF_MAX];
+   int     order[LEAF_MAX];
+   double  start_x, start_y, end_x, end_y;
+   double  best, d;
+   int     n = hi - lo;
+   int     full = (1 << n) - 1;
+   int     set, c, next, last;
+
+   const Workspace *ws = ctx->ws;
+
+   assert(n >= 2 && n <= LEAF_MAX);
+
+   leaf_point(ctx, level, lo, start, &start_x, &start_y);
+   leaf_point(ctx, level, lo, end, &end_x, &end_y);
+
+   for (c = 0; c < n; c++) {
+      city[c] = sorted_city(ctx, lo + c);
+      for (set = 0; set <= full; set++)
+         cost[set][c] = INFINITY;
+      cost[1 << c][c] = hypot(ws->rot_x[city[c]] - start_x,
+                              ws->rot_y[city[c]] - start_y);
+      prev[1 << c][c] = -1;
+   }
 
-   if (BIT_CELL_TR & cells && !node_in_route(NODE_CELL_TR, route))
-      return 0;
+   for (set = 1; set < full; set++)
+      for (c = 0; c < n; c++) {
+         if (cost[set][c] == INFINITY)
+            continue;
+         for (next = 0; next < n; next++) {
+            if (set & 1 << next)
+               continue;
+            d = cost[set][c] + city_distance(ctx->tsp, city[c], city[next]);
+            if (d < cost[set | 1 << next][next]) {
+               cost[set | 1 << next][next] = d;
+               prev[set | 1 << next][next] = c;
+            }
+         }
+      }
 
-   if (BIT_CELL_BL & cells && !node_in_route(NODE_CELL_BL, route))
-      return 0;
+   last = 0;
+   best = INFINITY;
+   for (c = 0; c < n; c++) {
+      d = cost[full][c] + hypot(ws->rot_x[city[c]] - end_x,
+                                ws->rot_y[city[c]] - end_y);
+      if (d < best) {
+         best = d;
+         last = c;
+      }
+   }
 
-   if (BIT_CELL_BR & cells && !node_in_route(NODE_CELL_BR, route))
-      return 0;
+   for (set = full, c = last, next = n - 1; c != -1; next--) {
+      order[next] = city[c];
+      last = prev[set][c];
+      set &= ~(1 << c);
+      c = last;
+   }
 
-   return 1;
+   start_piece(part, ind);
+   for (c = 0; c < n; c++)
+      place_city(ctx, part, ind + c, order[c]);
+   close_piece(ctx, part, ind, ind + n);
 }
 
 /*
- * Check if there are extra visitable points on the edge
- * if so return the number of the edge(12-16). Otherwise return -1;
+ * Find the position of a node of the cell of the city lo at level, in the
+ * rotated plane.
  */
-static int
-point_on_edge(int edge_start, int edge_finish)
+static void
+leaf_point(const Context * ctx, unsigned int level, int lo, int node,
+           double *x, double *y)
 {
-   int     swap;
+   double  cells = pow(CELL_SIDE, level);
+   double  width = (ctx->x_max - ctx->x_min) / cells;
+   double  height = (ctx->y_max - ctx->y_min) / cells;
+   double  offset_x, offset_y;
+   unsigned int cell_x, cell_y;
 
-   /*
-    * Put smallest node in front to reduce if statements
-    */
-   if (edge_start > edge_finish) {
-      swap = edge_start;
-      edge_start = edge_finish;
-      edge_finish = swap;
-   }
-   
-   if (edge_start == NODE_CELL_TL && edge_finish == NODE_CELL_TR)
-      return NODE_CROSS_T;
-   else if (edge_start == NODE_CELL_TL && edge_finish == NODE_CELL_BL)
-      return NODE_CROSS_L;
-   else if (edge_start == NODE_CELL_TL && edge_finish == NODE_CELL_BR)
-      return NODE_CROSS_C;
-   else if (edge_start == NODE_CELL_TR && edge_finish == NODE_CELL_BL)
-      return NODE_CROSS_C;
-   else if (edge_start == NODE_CELL_TR && edge_finish == NODE_CELL_BR)
-      return NODE_CROSS_R;
-   else if (edge_start == NODE_CELL_BL && edge_finish == NODE_CELL_BR)
-      return NODE_CROSS_B;
-
-   return -1;
+   key_cell(ctx->ws->keys[lo], level, &cell_x, &cell_y);
+   node_offset(node, &offset_x, &offset_y);
+
+   *x = ctx->x_min + (cell_x + 0.5 + offset_x) * width;
+   *y = ctx->y_min + (cell_y + 0.5 + offset_y) * height;
 }
 
 /*
- * Function which returns in which cell a point is located.
- * Returns the two possible cells. If cell is not fund, -1 is used
- * There is one exception: The point in the middle returns ANY_NODE_CELL
- * in cell_a since this one can belong to any cell
+ * Move size blocks from index from to index to.
  */
-void
-get_corresponding_cell(int point, int *cell_a, int *cell_b)
+static void
+move_blocks(Blocks * blocks, int to, int from, int size)
 {
-   *cell_a = -1;
-   *cell_b = -1;
-
-   switch (point) {
-   case NODE_BORDER_TL:
-      *cell_a = NODE_CELL_TL;
-      break;
-   case NODE_BORDER_T:
-      *cell_a = NODE_CELL_TL;
-      *cell_b = NODE_CELL_TR;
-      break;
-   case NODE_BORDER_TR:
-      *cell_a = NODE_CELL_TR;
-      break;
-   case NODE_BORDER_L:
-      *cell_a = NODE_CELL_TL;
-      *cell_b = NODE_CELL_BL;
-      break;
-   case NODE_BORDER_R:
-      *cell_a = NODE_CELL_TR;
-      *cell_b = NODE_CELL_BR;
-      break;
-   case NODE_BORDER_BL:
-      *cell_a = NODE_CELL_BL;
-      break;
-   case NODE_BORDER_B:
-      *cell_a = NODE_CELL_BL;
-      *cell_b = NODE_CELL_BR;
-      break;
-   case NODE_BORDER_BR:
-      *cell_a = NODE_CELL_BR;
-      break;
-   case NODE_CROSS_T:
-      *cell_a = NODE_CELL_TL;
-      *cell_b = NODE_CELL_TR;
-      break;
-   case NODE_CROSS_L:
-      *cell_a = NODE_CELL_TL;
-      *cell_b = NODE_CELL_BL;
-      break;
-   case NODE_CROSS_C:
-      *cell_a = ANY_NODE_CELL;
-      break;
-   case NODE_CROSS_R:
-      *cell_a = NODE_CELL_TR;
-      *cell_b = NODE_CELL_BR;
-      break;
-   case NODE_CROSS_B:
-      *cell_a = NODE_CELL_BL;
-      *cell_b = NODE_CELL_BR;
-      break;
-   }
+   memmove(blocks->route + to, blocks->route + from,
+           size * sizeof(uint16_t));
+   memmove(blocks->lo + to, blocks->lo + from, size * sizeof(int));
+   memmove(blocks->hi + to, blocks->hi + from, size * sizeof(int));
+   memmove(blocks->ind + to, blocks->ind + from, size * sizeof(int));
+}
+
+const Route *
+id_route(int id)
+{
+   assert(id >= 0 && id < ROUTE_IDS);
+
+   return &_routes[id];
 }
 
 /*
- * Get index of the cell in which the path <start> to <end> is located
+ * Place the cities of a block, of which every subcell holds at most one city,
+ * on the route. The subcells are visited in the order of the route through
+ * the block, starting at index first of the result.
  */
 void
-get_cell_index(Route * route, int start, int end, int *cell_a, int *cell_b)
+map_block_on_route(Context * ctx, Part * part, const Route * route,
+                   int first, const int *bounds)
 {
-   int     start_in_cell[CELL_NODES];
-   int     end_in_cell[CELL_NODES];
-   int     is_path;
-   int     i, j;
+   int     i;
+   int     ind = first;
+   int     location;
 
-   /* 
-    * Initialize fields
-    */
+   start_piece(part, ind);
    for (i = 0; i < CELL_NODES; i++) {
-      start_in_cell[i] = 0;
-      end_in_cell[i] = 0;
-   }
-
-   *cell_a = -1;
-   *cell_b = -1;
+      location = route->visits[i];
+      if (location == NO_NODE)
+         break;
 
-   
-   /*
-    * Get the cell where the start is located
-    */
-   get_corresponding_cell(route->trace[start], cell_a, cell_b);
-   if (*cell_a == ANY_NODE_CELL)
-      for (i = 0; i < CELL_NODES; i++)
-         start_in_cell[i] = 1;
-   else if (*cell_a != -1)
-      start_in_cell[*cell_a] = 1;
+      if (bounds[location + 1] != bounds[location]) {
+         place_city(ctx, part, ind, sorted_city(ctx, bounds[location]));
+         ind++;
+      }
+   }
+   close_piece(ctx, part, first, ind);
+}
 
-   if (*cell_b != -1)
-      start_in_cell[*cell_b] = 1;
+/*
+ * Convert visited cells into a bitmask
+ */
+int
+bitmask(const int *bounds)
+{
+   int     mask = 0;
 
-   /*
-    * Get the cell where the endpoint is located
-    */
-   get_corresponding_cell(route->trace[end], cell_a, cell_b);
-   if (*cell_a == ANY_NODE_CELL)
-      for (i = 0; i < CELL_NODES; i++)
-         end_in_cell[i] = 1;
-   else if (*cell_a != -1)
-      end_in_cell[*cell_a] = 1;
+   for (int i = 0; i < CELL_NODES; i++)
+      if (bounds[i + 1] != bounds[i])
+         mask |= 1 << i;
+   return mask;
+}
 
-   if (*cell_b != -1)
-      end_in_cell[*cell_b] = 1;
+/*
+ * Returns the largest number of cities in one of the subcells
+ */
+int
+max_cities(const int *bounds)
+{
+   int     i;
+   int     max = 0;
 
-   *cell_a = -1;
-   *cell_b = -1;
+   for (i = 0; i < CELL_NODES; i++)
+      if (bounds[i + 1] - bounds[i] > max)
+         max = bounds[i + 1] - bounds[i];
+   return max;
+}
 
+/*
+ * Get the basic route. A basic route is a case where no entry point and
+ * departure point are specified on the edge of the square. For each cell
+ * is specified if it needs to be visited or not using the arguments.
+ * The basic route is a closed path connecting the selected points
+ */
+int
+get_basic_route(int cells)
+{
    /*
-    * Check for each subcell if the startpoint and endpoint is in the cell.
-    * If so, dubbelcheck if the two points are really a path (e.g no point from 
-    * another cell is lying in between). Store this in available parameter
+    * The route table has no closed route through less than two cells.
     */
-   for (i = 0; i < CELL_NODES; i++) {
-      if (start_in_cell[i] && end_in_cell[i]) {
-         is_path = 1;
-         for (j = start + 1; j < end; j++)
-            if (route->trace[j] != i)
-               is_path = 0;
-
-         if (!is_path)
-            continue;
+   if (_routes[BASIC_ROUTE + cells].trace_length == 0)
+      errx(EX_DATAERR, "Try other grid range!\n");
 
-         if (*cell_a != -1)
-            *cell_b = i;
-         else
-            *cell_a = i;
-      }
-   }
+   return BASIC_ROUTE + cells;
 }
 
-/*
- * Convert a node into its identity in the specified subcell
- */
 int
-convert_node(int location, int main_node)
+get_open_route(int entry, int departure, int cells)
 {
-   switch (location) {
-   case NODE_CELL_TL:
-      switch (main_node) {
-      case NODE_BORDER_T:
-         return NODE_BORDER_TR;
-      case NODE_BORDER_L:
-         return NODE_BORDER_BL;
-      case NODE_CROSS_T:
-         return NODE_BORDER_R;
-      case NODE_CROSS_L:
-         return NODE_BORDER_B;
-      case NODE_CROSS_C:
-         return NODE_BORDER_BR;
-      }
-      break;
-   case NODE_CELL_TR:
-      switch (main_node) {
-      case NODE_BORDER_T:
-         return NODE_BORDER_TL;
-      case NODE_BORDER_R:
-         return NODE_BORDER_BR;
-      case NODE_CROSS_T:
-         return NODE_BORDER_L;
-      case NODE_CROSS_C:
-         return NODE_BORDER_BL;
-      case NODE_CROSS_R:
-         return NODE_BORDER_B;
-      }
-      break;
-   case NODE_CELL_BL:
-      switch (main_node) {
-      case NODE_BORDER_L:
-         return NODE_BORDER_TL;
-      case NODE_BORDER_B:
-         return NODE_BORDER_BR;
-      case NODE_CROSS_L:
-         return NODE_BORDER_T;
-      case NODE_CROSS_C:
-         return NODE_BORDER_TR;
-      case NODE_CROSS_B:
-         return NODE_BORDER_R;
-      }
-      break;
-   case NODE_CELL_BR:
-      switch (main_node) {
-      case NODE_BORDER_R:
-         return NODE_BORDER_TR;
-      case NODE_BORDER_B:
-         return NODE_BORDER_BL;
-      case NODE_CROSS_C:
-         return NODE_BORDER_TL;
-      case NODE_CROSS_R:
-         return NODE_BORDER_T;
-      case NODE_CROSS_B:
-         return NODE_BORDER_L;
-      }
-      break;
-   }
-   return main_node;
+   int     id = route_id(entry, departure, cells);
+
+   if (_routes[id].trace_length == 0)
+      errx(EX_DATAERR, "No route from border point %d to %d", entry,
+           departure);
+
+   return id;
 }
 
 /*
@@ -1124,54 +846,11 @@ convert_node(int location, int main_node)
 static void
 node_offset(int node, double *x, double *y)
 {
-   *x = 0.0;
-   *y = 0.0;
-
-   switch (node) {
-   case NODE_BORDER_TL:
-   case NODE_BORDER_L:
-   case NODE_BORDER_BL:
-      *x = -0.5;
-      break;
-   case NODE_CELL_TL:
-   case NODE_CELL_BL:
-   case NODE_CROSS_L:
-      *x = -0.25;
-      break;
-   case NODE_CELL_TR:
-   case NODE_CELL_BR:
-   case NODE_CROSS_R:
-      *x = 0.25;
-      break;
-   case NODE_BORDER_TR:
-   case NODE_BORDER_R:
-   case NODE_BORDER_BR:
-      *x = 0.5;
-      break;
-   }
+   int     px, py;
 
-   switch (node) {
-   case NODE_BORDER_TL:
-   case NODE_BORDER_T:
-   case NODE_BORDER_TR:
-      *y = -0.5;
-      break;
-   case NODE_CELL_TL:
-   case NODE_CELL_TR:
-   case NODE_CROSS_T:
-      *y = -0.25;
-      break;
-   case NODE_CELL_BL:
-   case NODE_CELL_BR:
-   case NODE_CROSS_B:
-      *y = 0.25;
-      break;
-   case NODE_BORDER_BL:
-   case NODE_BORDER_B:
-   case NODE_BORDER_BR:
-      *y = 0.5;
-      break;
-   }
+   node_position(node, &px, &py);
+   *x = (px - CELL_SIDE) / (2.0 * CELL_SIDE);
+   *y = (py - CELL_SIDE) / (2.0 * CELL_SIDE);
 }
 
 /*
@@ -1179,16 +858,18 @@ node_offset(int node, double *x, double *y)
  * visited points, which on connection form the path
  */
 void
-print_routes(Block * blocks, int max_size, FILE * f)
+print_routes(const Context * ctx, const Blocks * blocks, unsigned int level,
+             int max_size, FILE * f)
 {
    double  offset_x, offset_y;
    double  base_x, base_y;
    double  x, y;
    double  width_x, width_y;
 
-   Route  *route;
+   const Route *route;
 
    int     t, l;
+   unsigned int cell_x, cell_y;
 
    width_x = 2.0;
    width_y = 2.0;
@@ -1202,12 +883,11 @@ print_routes(Block * blocks, int max_size, FILE * f)
     * Print the visited points
     */
    for (t = 0; t < max_size; t++) {
-      route = blocks[t].route;
-      base_x = blocks[t].x * width_x + 0.5 * width_x;
-      base_y = blocks[t].y * width_y + 0.5 * width_y;
+      route = id_route(blocks->route[t]);
 
-      if (!route)
-         break;
+      key_cell(ctx->ws->keys[blocks->lo[t]], level, &cell_x, &cell_y);
+      base_x = cell_x * width_x + 0.5 * width_x;
+      base_y = cell_y * width_y + 0.5 * width_y;
 
       for (l = 0; l < route->trace_length; l++) {
          node_offset(route->trace[l], &offset_x, &offset_y);
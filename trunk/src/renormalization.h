@@ -1,24 +1,25 @@
 #ifndef RENORMALIZATION_H
 #define RENORMALIZATION_H
 
+#include <stdint.h>
+
 #include "block.h"
+#include "distance.h"
 #define MARGE 0.1
 
-#define BIT_CELL_TL 1
-#define BIT_CELL_TR 2
-#define BIT_CELL_BL 4
-#define BIT_CELL_BR 8
-#define BIT_CELL_MAX 16
-
-#define CELL_NODES 4
+/*
+ * The basic cell is divided into CELL_NODES cells, the cell at (x, y) is node
+ * CELL_SIDE * y + x. A set of cells is a bitmask of their nodes.
+ */
+#define CELL_NODES SUBCELLS
+#define BIT_CELL_MAX (1 << CELL_NODES)
 #define BORDER_NODES 8
-#define CROSS_NODES 5
-#define NORMAL_NODES CELL_NODES + BORDER_NODES
-#define NODES CELL_NODES + BORDER_NODES + CROSS_NODES
+#define CROSS_NODES (2 * CELL_SIDE * (CELL_SIDE - 1) + \
+                     (CELL_SIDE - 1) * (CELL_SIDE - 1))
+#define NODES (CELL_NODES + BORDER_NODES + CROSS_NODES)
 
 /*
  * T = Top
- * C = Center
  * L = Left
  * R = Right
  * B = Bottom
@@ -27,144 +28,173 @@
  * BL = Bottom Left
  * BR = Bottom Right
  */
-#define NODE_CELL_TL 0
-#define NODE_CELL_TR 1
-#define NODE_CELL_BL 2
-#define NODE_CELL_BR 3
-#define ANY_NODE_CELL 4
-
-#define NODE_BORDER_TL 4
-#define NODE_BORDER_T 5
-#define NODE_BORDER_TR 6
-#define NODE_BORDER_L 7
-#define NODE_BORDER_R 8
-#define NODE_BORDER_BL 9
-#define NODE_BORDER_B 10
-#define NODE_BORDER_BR 11
-
-#define NODE_CROSS_T 12
-#define NODE_CROSS_L 13
-#define NODE_CROSS_C 14
-#define NODE_CROSS_R 15
-#define NODE_CROSS_B 16
+#define NODE_BORDER_TL (CELL_NODES + 0)
+#define NODE_BORDER_T (CELL_NODES + 1)
+#define NODE_BORDER_TR (CELL_NODES + 2)
+#define NODE_BORDER_L (CELL_NODES + 3)
+#define NODE_BORDER_R (CELL_NODES + 4)
+#define NODE_BORDER_BL (CELL_NODES + 5)
+#define NODE_BORDER_B (CELL_NODES + 6)
+#define NODE_BORDER_BR (CELL_NODES + 7)
+#define NODE_CROSS (CELL_NODES + BORDER_NODES)
 
 /*
- * Basic two by two cell. This cell has three types of points. These points are:
- * - Border points: points on the border of the two by two cell
+ * Basic cell. This cell has three types of points. These points are:
+ * - Border points: the corners and the middles of the sides of the cell
  * - Cross points: Points internal in the basic cell where an edge crosses the 
- *                 internal border
+ *                 internal border, the middle of the side between two cells
+ *                 or the corner between four cells
  * 
- * The basic cell is divided into four cells: NODE_CELL_TL, NODE_CELL_TR, 
- *                                            NODE_CELL_BL and NODE_CELL_BR
- * 
- * In a picture you can see this as follows:
+ * For a side of two you can see this in a picture as follows:
  * 
  *  [TL]------------[T]------------[TR]
  *  |                |              |
- *  |     (TL)      {T}    (TR)     | 
+ *  |     (0)       {.}     (1)     | 
  *  |                |              |
- *  [L]---{L}-------{C}----{R}-----[R]
+ *  [L]---{.}-------{.}----{.}-----[R]
  *  |                |              |
- *  |     (BL)      {B}    (BR)     | 
+ *  |     (2)       {.}     (3)     | 
  *  |                |              |
  *  [BL]------------[B]------------[BR]
  * 
  * Here [..] is a border point, {..} is a cross point and (..) is the node at 
- * the center of a cell
+ * the center of a cell. The points where a route enters and leaves a cell
+ * are always border points of the cell itself.
  *
  * The Cell has the following information stored:
  *  - Trace is an optimal route in the node, where each visited point is stored
  *  - Trace_length is the length of this trace
  *  - Length is the length of the optimal tour
+ *  - visits are the cells in the order of the route
  *  - start and end are array where the reference points of the basic cells are 
  *    stored (The start and endpoint) 
+ *
+ * The nodes are stored in bytes, NO_NODE marks a node which is not used. A
+ * route alternates between cells and points, so its trace is at most 
+ * TRACE_NODES long.
  */
+#define NO_NODE 0xff
+#define TRACE_NODES (2 * CELL_NODES + 1)
+
 typedef struct
 {
-   int     trace[NODES];
-   int     trace_length;
-
    double  length;
 
-   int     visits[CELL_NODES];
-   int     start[CELL_NODES];
-   int     end[CELL_NODES];
+   uint8_t trace[TRACE_NODES];
+   uint8_t trace_length;
+
+   uint8_t visits[CELL_NODES];
+   uint8_t start[CELL_NODES];
+   uint8_t end[CELL_NODES];
 } Route;
 
-typedef struct
-{
-   Route **routes;
-   int     size;
-} Route_array;
+/*
+ * The ids of the routes in the route table. The ids below BASIC_ROUTE are 
+ * the routes between two border points, see route_id(), the closed route 
+ * through the cells of a bitmask has id BASIC_ROUTE + cells.
+ */
+#define BASIC_ROUTE (BORDER_NODES * BORDER_NODES * BIT_CELL_MAX)
+#define ROUTE_IDS (BASIC_ROUTE + BIT_CELL_MAX)
 
+/*
+ * The blocks on the route of a level, stored as one array per field. The
+ * cities in block i are the cities lo[i] up to hi[i] in the sorted order of
+ * block.h, they are placed on the route from index ind[i] onwards, following
+ * the route with id route[i]. The cell of a block is the cell of the key of
+ * its city lo[i], so it is not stored.
+ */
 typedef struct
 {
-   Route  *route;
-   int     x;
-   int     y;
-} Block;
+   uint16_t *route;
+   int    *lo;
+   int    *hi;
+   int    *ind;
+} Blocks;
 
 /*
- * Function which solves the Symmetric TSP by using renormalization technique
+ * A cell which holds at most the leaf cities of a context, see context.h, is
+ * not refined any further. The path through its cities is solved exactly,
+ * which needs memory exponential in the number of cities, so LEAF_MAX is
+ * the largest leaf. By default cells of up to LEAF_CITIES cities are leaves.
  */
-int    *renormalize();
+#define LEAF_MAX 8
+#define LEAF_CITIES 5
 
 /*
- * Get the basic route. A basic route is a case where no entry point and 
- * departure point are specified on the edge of the square. For each cell
- * is specified if it needs to be visited or not using the arguments. 
- * The basic route is a closed path connecting the selected points
+ * The blocks of a level are expanded in parts of PART_BLOCKS blocks. A part
+ * places the cities of its blocks on the indices lo up to hi of the route,
+ * and makes the blocks of the next level from offset on.
  */
-Route  *get_basic_route(int cells);
+#define PART_BLOCKS 64
+
+typedef struct
+{
+   int     first;
+   int     last;
+   int     lo;
+   int     hi;
+   int     offset;
+   int     size;
+
+   /* The length of the edges which are placed by the part. */
+   Length  length;
+   /* The piece of the route which is being placed. */
+   int     piece_start;
+   int     piece_first;
+   int     piece_last;
+   /* Set if an edge to a piece before lo or from hi on is left out. */
+   int     skip_lo;
+   int     skip_hi;
+} Part;
 
 /*
- * Calculate all shortest routes for the default graph(See top of this file). 
- * Here difference is made for the cells which are visited. For all 
- * the nodes shortest paths are calculated for every possible combination of 
- * cells which need to be visited. The visited cells are encoded using bitmasks,
- * for making the iteration more simple.
- */
-void    preprocess_routes();
-void    free_routes();
-/*
- * Finds entry and departure blocks in one route block 
+ * Function which solves the Symmetric TSP by using renormalization technique.
+ * If length is not NULL the length of the route is stored in it, this is
+ * computed while the route is built. The route is stored in the workspace, so
+ * it is only valid until the next call.
  */
-void    set_borderpoints_subblocks(Route * route);
+int    *renormalize(Context * ctx, double *length);
 /*
- * Function giving all possible paths between start and end, which visit each 
- * node maximal one time. It results a list of pointers to the found routes
+ * Returns the length of the route which renormalize() would build, without
+ * storing the route itself.
  */
-Route_array paths(int start, int end, int visited);
-
+double  renormalize_energy(Context * ctx);
 /*
- * Add a route to a route array. 
- * Herefore the allocated size of the array is increased
+ * The same as renormalize_energy(), but the route is abandoned as soon as it
+ * can not be shorter than limit. Then a lower bound on its length is 
+ * returned, which is larger than limit.
  */
-void    add_route(Route_array * array, Route * route);
-
+double  renormalize_bounded(Context * ctx, double limit);
 /*
- *  Copy a route
+ * The same as renormalize_bounded(), but the cells are only refined for 
+ * depth levels. Every block which is left is replaced by one of its cities,
+ * so the length of this coarser route is returned. With a depth of 
+ * MAX_LEVEL the route is complete.
  */
-Route  *copy_route(Route * src);
+double  renormalize_depth(Context * ctx, unsigned int depth, double limit);
 
 /*
- * Check if a specific node is in the route
+ * Get the basic route. A basic route is a case where no entry point and 
+ * departure point are specified on the edge of the square. For each cell
+ * is specified if it needs to be visited or not using the arguments. 
+ * The basic route is a closed path connecting the selected points, its id
+ * is returned.
  */
-int     node_in_route(int node, Route * route);
-
+int     get_basic_route(int cells);
 /*
- * Check if the route is valid and visits the cells specified in 
- * the bitmask <cells>
+ * Get the route which enters the basic cell at the border point entry, 
+ * visits the cells and departs at the border point departure. Its id is
+ * returned.
  */
-int     route_visits_cells(Route * route, int cells);
-
-void    make_weight_matrix();
-int     bitmask(grd * grid, int ind_x, int ind_y);
-int     convert_node(int location, int global_point);
-void    get_corresponding_cell(int point, int *cell_a, int *cell_b);
-void    get_cell_index(Route * route, int start, int end, int *cell_a,
-                       int *cell_b);
-void    print_routes(Block * blocks, int size, FILE * f);
-void    map_block_on_route(Block * block, grd * grid, int *ind);
+int     get_open_route(int entry, int departure, int cells);
+
+int     bitmask(const int *bounds);
+int     max_cities(const int *bounds);
+/* Returns the route of the route table with an id. */
+const Route *id_route(int id);
+void    print_routes(const Context * ctx, const Blocks * blocks,
+                     unsigned int level, int size, FILE * f);
+void    map_block_on_route(Context * ctx, Part * part, const Route * route,
+                           int ind, const int *bounds);
 
 #endif
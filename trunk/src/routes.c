@@ -0,0 +1,566 @@
+#include <assert.h>
+#include <sysexits.h>
+#include <stdlib.h>
+#include <limits.h>
+#include <math.h>
+#include <err.h>
+
+#include "routes.h"
+
+/*
+ * The routes are computed with dynamic programming over the sets of visited
+ * cells, as in the Held-Karp algorithm: the cost of the cheapest path which
+ * visits exactly a set of cells and ends in one of them is found from the
+ * cheapest paths through the set without that cell. A route through a set
+ * of cells is the cheapest path through any superset of it.
+ *
+ * The cost of an edge is the distance between its points in subcells,
+ * rounded to COST_UNIT. These are the weights 0.707, 1.0 and 1.414 of the
+ * two by two cell, and equal routes have exactly equal costs.
+ */
+#define COST_UNIT 1000
+#define NO_COST INT_MAX
+
+/*
+ * The rank of a path among the paths with the same ends and cells, see 
+ * rank_path(). The path with the lowest rank is taken.
+ */
+typedef struct
+{
+   int     cost;
+   double  length;
+   int     order;
+} Rank;
+
+static int adjacent(int a, int b);
+static int touches(int point, int cell);
+static int edge_cost(int a, int b);
+static int point_at(int x, int y);
+static int cross_node(int a, int b);
+static int cell_border(int cell, int point);
+static int cells_count(int cells);
+static void rank_path(Rank * rank, int cost, int size, const int *cells,
+                      int start, int end);
+static int ranks_before(const Rank * a, const Rank * b);
+static int clockwise(int size, const int *cells);
+static int closes_twice(int a, int b);
+static void empty_route(Route * route);
+static void make_route(Route * route, double length, int size,
+                       const int *cells, const int *points);
+static void trace_back(int prev[BIT_CELL_MAX][CELL_NODES], int set, int last,
+                       int *cells);
+static void path_routes(Route * routes, int start);
+static void basic_routes(Route * routes);
+
+void
+compute_routes(Route * routes)
+{
+   int     start;
+
+   assert(routes != NULL);
+
+   for (start = NODE_BORDER_TL; start <= NODE_BORDER_BR; start++)
+      path_routes(routes, start);
+   basic_routes(routes);
+}
+
+int
+route_id(int start, int end, int cells)
+{
+   return ((start - CELL_NODES) * BORDER_NODES + end - CELL_NODES) *
+       BIT_CELL_MAX + cells;
+}
+
+void
+node_position(int node, int *x, int *y)
+{
+   /*
+    * The border points in sides of the basic cell.
+    */
+   static const int border[BORDER_NODES][2] = {
+      {0, 0}, {1, 0}, {2, 0}, {0, 1}, {2, 1}, {0, 2}, {1, 2}, {2, 2}
+   };
+   const int side = CELL_SIDE - 1;
+   int     i;
+
+   assert(node >= 0 && node < NODES);
+
+   if (node < CELL_NODES) {
+      *x = 2 * (node % CELL_SIDE) + 1;
+      *y = 2 * (node / CELL_SIDE) + 1;
+      return;
+   }
+   if (node < NODE_CROSS) {
+      *x = border[node - CELL_NODES][0] * CELL_SIDE;
+      *y = border[node - CELL_NODES][1] * CELL_SIDE;
+      return;
+   }
+
+   /*
+    * The cross points are the middles of the vertical sides between two
+    * cells, the middles of the horizontal sides and the inner corners.
+    */
+   i = node - NODE_CROSS;
+   if (i < CELL_SIDE * side) {
+      *x = 2 * (i % side) + 2;
+      *y = 2 * (i / side) + 1;
+      return;
+   }
+   i -= CELL_SIDE * side;
+   if (i < CELL_SIDE * side) {
+      *x = 2 * (i % CELL_SIDE) + 1;
+      *y = 2 * (i / CELL_SIDE) + 2;
+      return;
+   }
+   i -= CELL_SIDE * side;
+   *x = 2 * (i % side) + 2;
+   *y = 2 * (i / side) + 2;
+}
+
+/*
+ * Find the cheapest routes from the border point start to every other border
+ * point, through every set of cells.
+ */
+static void
+path_routes(Route * routes, int start)
+{
+   int     cost[BIT_CELL_MAX][CELL_NODES];
+   int     prev[BIT_CELL_MAX][CELL_NODES];
+   Rank    best[BORDER_NODES][BIT_CELL_MAX];
+   Rank    rank;
+   int     cells[CELL_NODES];
+   int     points[CELL_NODES + 1];
+   int     set, mask, c, d, end, i;
+
+   for (set = 0; set < BIT_CELL_MAX; set++)
+      for (c = 0; c < CELL_NODES; c++)
+         cost[set][c] = NO_COST;
+   for (c = 0; c < CELL_NODES; c++)
+      if (touches(start, c)) {
+         cost[1 << c][c] = edge_cost(start, c);
+         prev[1 << c][c] = -1;
+      }
+
+   /*
+    * A set is only extended to larger sets, so every set is finished before
+    * it is extended.
+    */
+   for (set = 1; set < BIT_CELL_MAX; set++)
+      for (c = 0; c < CELL_NODES; c++) {
+         if (cost[set][c] == NO_COST)
+            continue;
+         for (d = 0; d < CELL_NODES; d++) {
+            int     next = set | 1 << d;
+
+            if ((set & 1 << d) || !adjacent(c, d))
+               continue;
+            if (cost[set][c] + edge_cost(c, d) < cost[next][d]) {
+               cost[next][d] = cost[set][c] + edge_cost(c, d);
+               prev[next][d] = c;
+            }
+         }
+      }
+
+   for (end = 0; end < BORDER_NODES; end++)
+      for (mask = 0; mask < BIT_CELL_MAX; mask++) {
+         best[end][mask].cost = NO_COST;
+         empty_route(&routes[route_id(start, end + CELL_NODES, mask)]);
+      }
+
+   /*
+    * A route which returns to its start needs two cells at least, otherwise
+    * it would use the same edge twice.
+    */
+   for (set = 1; set < BIT_CELL_MAX; set++)
+      for (c = 0; c < CELL_NODES; c++) {
+         if (cost[set][c] == NO_COST)
+            continue;
+         for (end = 0; end < BORDER_NODES; end++) {
+            int     point = end + CELL_NODES;
+            int     total;
+
+            if (!touches(point, c) ||
+                (point == start && cells_count(set) < 2))
+               continue;
+            total = cost[set][c] + edge_cost(c, point);
+            trace_back(prev, set, c, cells);
+            rank_path(&rank, total, cells_count(set), cells, start, point);
+
+            for (mask = set;; mask = (mask - 1) & set) {
+               if (ranks_before(&rank, &best[end][mask])) {
+                  best[end][mask] = rank;
+
+                  points[0] = start;
+                  for (i = 1; i < cells_count(set); i++)
+                     points[i] = cross_node(cells[i - 1], cells[i]);
+                  points[cells_count(set)] = point;
+                  make_route(&routes[route_id(start, point, mask)],
+                             rank.length, cells_count(set), cells, points);
+               }
+               if (mask == 0)
+                  break;
+            }
+         }
+      }
+}
+
+/*
+ * Find the cheapest closed route through every set of at least two cells.
+ * A route through two cells enters and leaves both through the same point,
+ * so it is only taken if the routes through the cells can return to that
+ * point. Of equal routes the one through the fewest cells is taken, and then
+ * the one which goes clockwise.
+ */
+static void
+basic_routes(Route * routes)
+{
+   int     cost[BIT_CELL_MAX][CELL_NODES];
+   int     prev[BIT_CELL_MAX][CELL_NODES];
+   int     best[BIT_CELL_MAX];
+   int     best_size[BIT_CELL_MAX];
+   int     best_clockwise[BIT_CELL_MAX];
+   int     cells[CELL_NODES];
+   int     turn;
+   int     points[CELL_NODES + 1];
+   int     first, set, mask, c, d, i, size;
+
+   for (mask = 0; mask < BIT_CELL_MAX; mask++) {
+      best[mask] = NO_COST;
+      empty_route(&routes[BASIC_ROUTE + mask]);
+   }
+
+   /*
+    * Every closed route is found from the first of its cells.
+    */
+   for (first = 0; first < CELL_NODES; first++) {
+      for (set = 0; set < BIT_CELL_MAX; set++)
+         for (c = 0; c < CELL_NODES; c++)
+            cost[set][c] = NO_COST;
+      cost[1 << first][first] = 0;
+      prev[1 << first][first] = -1;
+
+      for (set = 1 << first; set < BIT_CELL_MAX; set++)
+         for (c = first; c < CELL_NODES; c++) {
+            if (cost[set][c] == NO_COST)
+               continue;
+            for (d = first + 1; d < CELL_NODES; d++) {
+               int     next = set | 1 << d;
+
+               if ((set & 1 << d) || !adjacent(c, d))
+                  continue;
+               if (cost[set][c] + edge_cost(c, d) < cost[next][d]) {
+                  cost[next][d] = cost[set][c] + edge_cost(c, d);
+                  prev[next][d] = c;
+               }
+            }
+         }
+
+      for (set = 1 << first; set < BIT_CELL_MAX; set++)
+         for (c = first + 1; c < CELL_NODES; c++) {
+            int     total;
+
+            size = cells_count(set);
+            if (cost[set][c] == NO_COST || !adjacent(c, first) ||
+                (size < 3 && !closes_twice(first, c)))
+               continue;
+            total = cost[set][c] + edge_cost(c, first);
+            trace_back(prev, set, c, cells);
+            turn = clockwise(size, cells);
+
+            for (mask = set;; mask = (mask - 1) & set) {
+               if (cells_count(mask) >= 2 &&
+                   (total < best[mask] ||
+                    (total == best[mask] && size < best_size[mask]) ||
+                    (total == best[mask] && size == best_size[mask] &&
+                     turn > best_clockwise[mask]))) {
+                  best[mask] = total;
+                  best_size[mask] = size;
+                  best_clockwise[mask] = turn;
+
+                  /*
+                   * The route starts and ends at the point between its last
+                   * and its first cell.
+                   */
+                  points[0] = cross_node(cells[size - 1], cells[0]);
+                  for (i = 1; i < size; i++)
+                     points[i] = cross_node(cells[i - 1], cells[i]);
+                  points[size] = points[0];
+                  make_route(&routes[BASIC_ROUTE + mask],
+                             (double) total / COST_UNIT, size, cells, points);
+               }
+               if (mask == 0)
+                  break;
+            }
+         }
+   }
+}
+
+/*
+ * Find the cells of the cheapest path through set which ends in last.
+ */
+static void
+trace_back(int prev[BIT_CELL_MAX][CELL_NODES], int set, int last, int *cells)
+{
+   int     i = cells_count(set);
+
+   while (last != -1) {
+      int     c = prev[set][last];
+
+      cells[--i] = last;
+      set &= ~(1 << last);
+      last = c;
+   }
+   assert(i == 0);
+}
+
+/*
+ * Store the route through size cells, points[i] is the point before cell i
+ * and points[i + 1] the point after it.
+ */
+static void
+make_route(Route * route, double length, int size, const int *cells,
+           const int *points)
+{
+   int     i;
+
+   empty_route(route);
+   route->length = length;
+
+   route->trace[route->trace_length++] = points[0];
+   for (i = 0; i < size; i++) {
+      route->trace[route->trace_length++] = cells[i];
+      route->trace[route->trace_length++] = points[i + 1];
+
+      /*
+       * The points are stored as the border points of the cell itself, so
+       * they can be used to find the route through the cell at the next
+       * level.
+       */
+      route->visits[i] = cells[i];
+      route->start[cells[i]] = cell_border(cells[i], points[i]);
+      route->end[cells[i]] = cell_border(cells[i], points[i + 1]);
+   }
+}
+
+static void
+empty_route(Route * route)
+{
+   int     i;
+
+   route->length = 0.0;
+   route->trace_length = 0;
+   for (i = 0; i < TRACE_NODES; i++)
+      route->trace[i] = NO_NODE;
+   for (i = 0; i < CELL_NODES; i++) {
+      route->visits[i] = NO_NODE;
+      route->start[i] = NO_NODE;
+      route->end[i] = NO_NODE;
+   }
+}
+
+/*
+ * Returns whether the cells a and b are different and share a side or a
+ * corner.
+ */
+static int
+adjacent(int a, int b)
+{
+   int     dx = a % CELL_SIDE - b % CELL_SIDE;
+   int     dy = a / CELL_SIDE - b / CELL_SIDE;
+
+   return a != b && abs(dx) <= 1 && abs(dy) <= 1;
+}
+
+/*
+ * Returns whether the point is on the border of the cell.
+ */
+static int
+touches(int point, int cell)
+{
+   int     px, py, cx, cy;
+
+   node_position(point, &px, &py);
+   node_position(cell, &cx, &cy);
+
+   return abs(px - cx) <= 1 && abs(py - cy) <= 1;
+}
+
+static int
+edge_cost(int a, int b)
+{
+   int     ax, ay, bx, by;
+
+   node_position(a, &ax, &ay);
+   node_position(b, &bx, &by);
+
+   return (int) lround(COST_UNIT * hypot(ax - bx, ay - by) / 2);
+}
+
+/*
+ * Returns the point at a position, or -1 if there is none.
+ */
+static int
+point_at(int x, int y)
+{
+   int     node, px, py;
+
+   for (node = CELL_NODES; node < NODES; node++) {
+      node_position(node, &px, &py);
+      if (px == x && py == y)
+         return node;
+   }
+   return -1;
+}
+
+/*
+ * Returns the point which the edge between the adjacent cells a and b
+ * crosses.
+ */
+static int
+cross_node(int a, int b)
+{
+   int     ax, ay, bx, by;
+   int     node;
+
+   assert(adjacent(a, b));
+
+   node_position(a, &ax, &ay);
+   node_position(b, &bx, &by);
+
+   if ((node = point_at((ax + bx) / 2, (ay + by) / 2)) == -1)
+      errx(EX_SOFTWARE, "No point between cells %d and %d", a, b);
+   return node;
+}
+
+/*
+ * Returns the border point of the cell which is at the same position as a
+ * point of the basic cell.
+ */
+static int
+cell_border(int cell, int point)
+{
+   static const int border[3][3] = {
+      {NODE_BORDER_TL, NODE_BORDER_T, NODE_BORDER_TR},
+      {NODE_BORDER_L, -1, NODE_BORDER_R},
+      {NODE_BORDER_BL, NODE_BORDER_B, NODE_BORDER_BR}
+   };
+   int     px, py, cx, cy;
+
+   node_position(point, &px, &py);
+   node_position(cell, &cx, &cy);
+
+   assert(touches(point, cell) && border[py - cy + 1][px - cx + 1] != -1);
+   return border[py - cy + 1][px - cx + 1];
+}
+
+/*
+ * Returns whether a closed route through the cells a and b, which enters and
+ * leaves both cells through the point between them, can be refined.
+ */
+static int
+closes_twice(int a, int b)
+{
+   int     point = cross_node(a, b);
+   int     cell = a;
+
+   for (int i = 0; i < 2; i++, cell = b) {
+      int     border = cell_border(cell, point);
+      int     touched = 0;
+
+      for (int c = 0; c < CELL_NODES; c++)
+         touched += touches(border, c);
+      if (touched < 2)
+         return 0;
+   }
+   return 1;
+}
+
+/*
+ * Returns whether the closed route through the cells goes clockwise.
+ */
+static int
+clockwise(int size, const int *cells)
+{
+   int     area = 0;
+   int     ax, ay, bx, by;
+
+   for (int i = 0; i < size; i++) {
+      node_position(cells[i], &ax, &ay);
+      node_position(cells[(i + 1) % size], &bx, &by);
+      area += ax * by - bx * ay;
+   }
+   return area > 0;
+}
+
+/*
+ * Rank the path from start through the cells to end, of the given cost. For
+ * a side of two the routes are the ones which the table had when it was
+ * built by enumerating every path, so the tours stay the same. Those paths
+ * were compared on their lengths in floating point, summed in the order of
+ * the enumeration, and the first of equal paths was taken: the paths were 
+ * enumerated by their cells from the last one back, and a path which returns
+ * to its start by its first cell before that. For larger sides the path 
+ * through the fewest cells is taken.
+ */
+static void
+rank_path(Rank * rank, int cost, int size, const int *cells, int start,
+          int end)
+{
+   rank->cost = cost;
+   rank->length = (double) cost / COST_UNIT;
+   rank->order = size;
+
+#if CELL_SIDE == 2
+   int     i;
+
+   /*
+    * A path which returns to its start was enumerated from its first cell,
+    * and the edge from the start was added last.
+    */
+   rank->length = (start == end) ? 0.0 :
+       (double) edge_cost(start, cells[0]) / COST_UNIT;
+   for (i = 1; i < size; i++)
+      rank->length += (double) edge_cost(cells[i - 1], cells[i]) / COST_UNIT;
+   rank->length += (double) edge_cost(cells[size - 1], end) / COST_UNIT;
+   if (start == end)
+      rank->length += (double) edge_cost(start, cells[0]) / COST_UNIT;
+
+   /*
+    * The digits of the order are the cells, followed by the start. A start
+    * is a border point, so it is larger than any cell.
+    */
+   rank->order = (start == end) ? cells[0] : 0;
+   for (i = size - 1; i >= 0; i--)
+      rank->order = rank->order * NODE_CROSS + cells[i];
+   rank->order = rank->order * NODE_CROSS + (start == end ? cells[0] : start);
+   for (i = size; i < CELL_NODES; i++)
+      rank->order *= NODE_CROSS;
+#else
+   (void) cells;
+   (void) start;
+   (void) end;
+#endif
+}
+
+/*
+ * Returns whether the path of rank a is taken before the path of rank b.
+ */
+static int
+ranks_before(const Rank * a, const Rank * b)
+{
+   if (a->cost != b->cost)
+      return a->cost < b->cost;
+   if (a->length != b->length)
+      return a->length < b->length;
+   return a->order < b->order;
+}
+
+static int
+cells_count(int cells)
+{
+   int     count = 0;
+
+   for (; cells != 0; cells &= cells - 1)
+      count++;
+   return count;
+}
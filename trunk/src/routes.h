@@ -0,0 +1,29 @@
+#ifndef ROUTES_H
+#define ROUTES_H
+
+#include "renormalization.h"
+
+/*
+ * The shortest routes through a block for every entry and departure point
+ * on its border and every set of visited cells, followed by the closed 
+ * routes through every set of cells, see ROUTE_IDS. The table is generated
+ * by mkroutes when tsp is built, see routes.c, and it is never changed, so it
+ * is shared by all the contexts. A set of cells which can not be visited has
+ * a route with trace_length 0.
+ */
+extern const Route _routes[ROUTE_IDS];
+
+/* Compute the table of routes, of ROUTE_IDS routes. */
+void    compute_routes(Route * routes);
+/*
+ * Returns the id of the route of the route table from the border point start
+ * to the border point end through the cells.
+ */
+int     route_id(int start, int end, int cells);
+/*
+ * Find the position of a node in the basic cell, in half subcells from its 
+ * top left corner.
+ */
+void    node_position(int node, int *x, int *y);
+
+#endif /* ROUTES_H */
@@ -1,8 +1,11 @@
 #include <math.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <err.h>
 #include <sysexits.h>
+#include <assert.h>
+#include <stdint.h>
 #include <gsl/gsl_randist.h>
 #include <gsl/gsl_cdf.h>
 #include <gsl/gsl_rng.h>
@@ -11,48 +14,159 @@
 #include "tsp.h"
 #include "renormalization.h"
 #include "distance.h"
+#include "context.h"
+#include "block.h"
 
 #ifndef M_PI
 #define M_PI 3.14159265358979
 #endif
 
 /* Returns the Brownian motion used to change the rotation. */
-static double neighbour_rot(double temp, double temp_end, double temp_init,
-                            double bm_sigma);
+static double neighbour_rot(Context * ctx, double temp, double temp_end,
+                            double temp_init, double bm_sigma);
+/* Store the route for the current rotation as the best tour of ctx. */
+static void store_tour(Context * ctx, double energy);
+/* Run the annealing of one of the chains of thermo_sa_chains(). */
+static void run_chain(void *arg, int i);
+/* Evaluate the rotations of one of the contexts of rotation_sweep(). */
+static void run_sweep(void *arg, int i);
+/* Compute the energy of one of the candidates of thermo_sa_batch(). */
+static void evaluate_candidate(void *arg, int j);
+/* Run the walk of one of the replicas of parallel_tempering(). */
+static void run_replica(void *arg, int i);
+/* Returns the index of the first context with the shortest tour. */
+static int best_context(Context ** ctx, int num);
+/* Returns the depth at which the annealing evaluates a rotation. */
+static unsigned int anneal_depth(const Context * ctx, unsigned int levels,
+                                 double temp, double temp_init,
+                                 double temp_end);
+/* Evaluate the grid of the current rotation of rotation_scan(). */
+static void scan_grid(Context * ctx, FILE * log);
+/* Returns the seed of the acceptance stream of the context with seed. */
+static unsigned long accept_seed(unsigned long seed);
+/* Returns the energy below which the Metropolis test accepts a state. */
+static double accept_limit(double energy, double temp, gsl_rng * rng);
 
-gsl_rng *_bm_rng;
+/*
+ * The number of steps every replica takes between two exchanges of 
+ * parallel_tempering().
+ */
+#define PT_STEPS 10
+
+/*
+ * The relative and absolute overshoot of a step of rotation_scan(), so a 
+ * step which is predicted to end on the border of a cell crosses it. The 
+ * absolute overshoot is also the precision to which the scan finds the 
+ * rotation at which the grid changes.
+ */
+#define SCAN_OVERSHOOT 1e-9
+#define SCAN_MIN_STEP 1e-12
+
+/* The arguments of thermo_sa() which are shared by all the chains. */
+typedef struct
+{
+   Context **ctx;
+   int     chains;
+   double  temp_init;
+   double  temp_end;
+   double  temp_sig;
+   double  initstate;
+   /* The initial rotation of every chain, or NULL to spread them. */
+   const double *starts;
+   double  bm_sigma;
+   double  k;
+   FILE   *log;
+} Chains;
+
+/* The rotations of rotation_sweep(). */
+typedef struct
+{
+   Context **ctx;
+   int     contexts;
+   int     angles;
+   double *energy;
+} Sweep;
+
+/* The candidate rotations of one step of thermo_sa_batch(). */
+typedef struct
+{
+   Context **ctx;
+   double *rotation;
+   double *energy;
+   double *bm;
+   /*
+    * The energy below which a candidate can be accepted, at the depth at 
+    * which it is evaluated, see below.
+    */
+   double *limit;
+   /* The depth at which the candidates are evaluated. */
+   unsigned int depth;
+} Candidates;
+
+/* The state of the replicas of parallel_tempering(). */
+typedef struct
+{
+   Context **ctx;
+   double *temp;
+   double *energy;
+   gsl_rng **acpt_rng;
+   double  temp_init;
+   double  bm_sigma;
+} Replicas;
 
 double
-thermo_sa(double temp_init, double temp_end, double temp_sig, double initstate,
-          double bm_sigma, double k, FILE * log)
+thermo_sa(Context * ctx, double temp_init, double temp_end, double temp_sig,
+          double initstate, double bm_sigma, double k, FILE * log)
+{
+   return thermo_sa_batch(ctx, NULL, 1, NULL, temp_init, temp_end, temp_sig,
+                          initstate, bm_sigma, k, log);
+}
+
+double
+thermo_sa_batch(Context * ctx, Context ** helpers, int batch, Pool * pool,
+                double temp_init, double temp_end, double temp_sig,
+                double initstate, double bm_sigma, double k, FILE * log)
 {
    double  energy, energy_new, energy_delta, energy_variation;
-   int    *path;
    double  temp, temp_old;
-   double  prob;
    double  rot_old, best_rot;
    double  entropy_variation;
-   double  energy_best;
+   double  energy_best, energy_scale = 1;
    gsl_rng *acpt_rng;
    unsigned long time = 0;
-   double  BM;
+   Candidates cand;
+   int     accepted, done;
+   unsigned int levels, energy_depth;
+
+   assert(batch > 0);
+   assert(batch == 1 || (helpers != NULL && pool != NULL));
 
    /*
-    * Initialize the random number generators. 
+    * Initialize the random number generator, the one of the Brownian motion
+    * belongs to the context. 
     */
-   _bm_rng = gsl_rng_alloc(gsl_rng_taus);
    acpt_rng = gsl_rng_alloc(gsl_rng_taus);
+   gsl_rng_set(acpt_rng, accept_seed(ctx->seed));
+
+   cand.ctx = (batch == 1) ? &ctx : helpers;
+   if ((cand.rotation = calloc(batch, sizeof(double))) == NULL ||
+       (cand.energy = calloc(batch, sizeof(double))) == NULL ||
+       (cand.bm = calloc(batch, sizeof(double))) == NULL ||
+       (cand.limit = calloc(batch, sizeof(double))) == NULL)
+      errx(EX_OSERR, "Out of memory!");
 
    temp = temp_init;
-   rotation = initstate;
+   ctx->rotation = initstate;
 
    /*
     * Compute the first path. 
     */
-   path = renormalize();
-   energy = route_length(path, tsp->dimension);
-	free(path);
+   energy = renormalize_energy(ctx);
    energy_best = energy;
+   best_rot = ctx->rotation;
+   store_tour(ctx, energy);
+   levels = ctx->levels;
+   energy_depth = MAX_LEVEL;
 
    entropy_variation = 0;
    energy_variation = 0;
@@ -64,69 +178,529 @@ thermo_sa(double temp_init, double temp_end, double temp_sig, double initstate,
       (void) fprintf(log, "time T E_n E_d E_v E_b S_v rb r rv bm\n");
 
    do {
-      temp_old = temp;
-      rot_old = rotation;
-      if (log != NULL)
-         (void) fprintf(log, "%lu ", time);
+      /*
+       * A coarser route is shorter, so the energies at a depth are scaled 
+       * by the ratio of the complete and the coarse energy of the current 
+       * state when the depth changes. The temperature and the variations
+       * stay comparable with the complete energies that way.
+       */
+      cand.depth = anneal_depth(ctx, levels, temp, temp_init, temp_end);
+      if (cand.depth != energy_depth) {
+         energy = renormalize_energy(ctx);
+         energy_scale = (cand.depth < MAX_LEVEL) ? energy /
+             renormalize_depth(ctx, cand.depth, INFINITY) : 1;
+         energy_depth = cand.depth;
+      }
 
-      BM = neighbour_rot(temp, temp_end, temp_init, bm_sigma);
+      /*
+       * Propose batch rotations from the current state at the current
+       * temperature, and evaluate them at the same time.
+       */
+      rot_old = ctx->rotation;
+      for (int j = 0; j < batch; j++) {
+         cand.bm[j] = neighbour_rot(ctx, temp, temp_end, temp_init, bm_sigma);
+         cand.rotation[j] = ctx->rotation;
+         ctx->rotation = rot_old;
 
-      if(fpclassify(rotation) == FP_NAN)
-          errx(EX_DATAERR, "Rotation can not be NaN");
-      path = renormalize();
-      energy_new = route_length(path, tsp->dimension);
-		free(path);
-      energy_delta = energy_new - energy;
+         if(fpclassify(cand.rotation[j]) == FP_NAN)
+             errx(EX_DATAERR, "Rotation can not be NaN");
+         cand.limit[j] = INFINITY;
+      }
 
-      prob = exp(-energy_delta / temp);
+      /*
+       * The Metropolis test only accepts an energy below a limit, see
+       * accept_limit(). A single candidate draws the limit before it is
+       * evaluated, so its route is abandoned as soon as it is known to be
+       * longer. An accepted route is always complete, so the current energy
+       * stays exact. The energy of a rejected one is a lower bound then, 
+       * which is used for the entropy variation and the log. A batch draws
+       * the limits after the evaluation, as the temperature of a candidate
+       * depends on the ones before it.
+       */
+      if (batch == 1) {
+         cand.limit[0] = accept_limit(energy, temp, acpt_rng) / energy_scale;
+         evaluate_candidate(&cand, 0);
+      } else
+         pool_run(pool, batch, evaluate_candidate, &cand);
 
-      if (log != NULL)
-			(void)fprintf(log, "%lf %lf %lf %lf %lf %lf %lf %lf %lf %lf\n",
-							temp, energy_new, energy_delta, energy_variation,
-							energy_best, entropy_variation, best_rot, rotation,
-                     (rotation - rot_old), BM);
-
-      if (gsl_rng_uniform(acpt_rng) < prob) {
-         if (energy_best > energy) {
-            energy_best = energy;
-            best_rot = rot_old;
+      /*
+       * Apply the acceptance rule to the candidates in the order in which
+       * they are proposed, every candidate is one step of the annealing. 
+       * The candidates after the first accepted one are proposed from a 
+       * state which is left, so they are dropped.
+       */
+      for (int j = 0; j < batch; j++) {
+         temp_old = temp;
+         ctx->rotation = cand.rotation[j];
+         if (log != NULL)
+            (void) fprintf(log, "%lu ", time);
+
+         energy_new = energy_scale * cand.energy[j];
+         energy_delta = energy_new - energy;
+
+         if (log != NULL)
+            (void)fprintf(log, "%lf %lf %lf %lf %lf %lf %lf %lf %lf %lf\n",
+                  temp, energy_new, energy_delta, energy_variation,
+                  energy_best, entropy_variation, best_rot, ctx->rotation,
+                  (ctx->rotation - rot_old), cand.bm[j]);
+
+         /*
+          * Only the best route is stored, the others are just evaluated.
+          * A coarse route which looks better is completed first, and only
+          * stored if the complete route is better as well.
+          */
+         if (energy_new < energy_best) {
+            double  energy_full = (cand.depth == MAX_LEVEL) ? energy_new :
+                renormalize_energy(ctx);
+
+            if (energy_full < energy_best) {
+               energy_best = energy_full;
+               best_rot = ctx->rotation;
+               store_tour(ctx, energy_full);
+            }
          }
-         energy = energy_new;
-         energy_variation += energy_delta;
-      } else
-         rotation = rot_old;
 
-      if (energy_delta > 0)
-         entropy_variation -= energy_delta / temp;
+         if (batch > 1)
+            cand.limit[j] = accept_limit(energy, temp, acpt_rng) /
+                energy_scale;
+         accepted = cand.energy[j] < cand.limit[j];
+         if (accepted) {
+            energy = energy_new;
+            energy_variation += energy_delta;
+         } else
+            ctx->rotation = rot_old;
 
-      if ((energy_variation >= 0) || fabs(entropy_variation) < 0.000001)
-         temp = temp_init;
-      else {
-         temp = k * (energy_variation / entropy_variation);
-         //rotation = best_rot;
+         if (energy_delta > 0)
+            entropy_variation -= energy_delta / temp;
+
+         if ((energy_variation >= 0) || fabs(entropy_variation) < 0.000001)
+            temp = temp_init;
+         else {
+            temp = k * (energy_variation / entropy_variation);
+            //rotation = best_rot;
+         }
+         time++;
+
+         done = !((temp > temp_end) || (fabs(temp - temp_old) > temp_sig));
+         if (accepted || done)
+            break;
       }
-      time++;
-   } while ((temp > temp_end) || (fabs(temp - temp_old) > temp_sig));
+   } while (!done);
 
    gsl_rng_free(acpt_rng);
-   gsl_rng_free(_bm_rng);
+   free(cand.rotation);
+   free(cand.energy);
+   free(cand.bm);
+   free(cand.limit);
 
    return energy_best;
 }
 
+/*
+ * Compute the energy of candidate j, in a context of its own.
+ */
+static void
+evaluate_candidate(void *arg, int j)
+{
+   Candidates *cand = arg;
+
+   cand->ctx[j]->rotation = cand->rotation[j];
+   cand->energy[j] = renormalize_depth(cand->ctx[j], cand->depth,
+                                       cand->limit[j]);
+}
+
+int
+thermo_sa_chains(Context ** ctx, int chains, Pool * pool, double temp_init,
+                 double temp_end, double temp_sig, double initstate,
+                 double bm_sigma, double k, FILE * log)
+{
+   Chains  args = { ctx, chains, temp_init, temp_end, temp_sig, initstate,
+      NULL, bm_sigma, k, log
+   };
+
+   assert(chains > 0);
+
+   pool_run(pool, chains, run_chain, &args);
+
+   return best_context(ctx, chains);
+}
+
+int
+thermo_sa_starts(Context ** ctx, int chains, Pool * pool, double temp_init,
+                 double temp_end, double temp_sig, const double *starts,
+                 double bm_sigma, double k, FILE * log)
+{
+   Chains  args = { ctx, chains, temp_init, temp_end, temp_sig, 0, starts,
+      bm_sigma, k, log
+   };
+
+   assert(chains > 0 && starts != NULL);
+
+   pool_run(pool, chains, run_chain, &args);
+
+   return best_context(ctx, chains);
+}
+
+static void
+run_chain(void *arg, int i)
+{
+   Chains *args = arg;
+
+   /*
+    * Unless they are given the initial rotations are spread evenly over the
+    * circle, only the first chain writes the log.
+    */
+   thermo_sa(args->ctx[i], args->temp_init, args->temp_end, args->temp_sig,
+             (args->starts != NULL) ? args->starts[i] :
+             fmod(args->initstate + 2 * M_PI * i / args->chains, 2 * M_PI),
+             args->bm_sigma, args->k, (i == 0) ? args->log : NULL);
+}
+
+int
+rotation_sweep(Context ** ctx, int contexts, Pool * pool, int angles,
+               double *starts, int num_starts, FILE * log)
+{
+   Sweep   args = { ctx, contexts, angles, NULL };
+   int     best = 0;
+
+   assert(contexts > 0 && num_starts <= angles);
+
+   if ((args.energy = calloc(angles, sizeof(double))) == NULL)
+      errx(EX_OSERR, "Out of memory!");
+
+   pool_run(pool, contexts, run_sweep, &args);
+
+   for (int j = 0; j < angles; j++) {
+      if (args.energy[j] < args.energy[best])
+         best = j;
+      if (log != NULL)
+         (void) fprintf(log, "%lf %lf\n", 2 * M_PI * j / angles,
+                        args.energy[j]);
+   }
+
+   /*
+    * The lowest energies are taken one by one, the first rotation of equal
+    * energies first.
+    */
+   for (int s = 0; s < num_starts; s++) {
+      int     low = 0;
+
+      for (int j = 1; j < angles; j++)
+         if (args.energy[j] < args.energy[low])
+            low = j;
+      starts[s] = 2 * M_PI * low / angles;
+      args.energy[low] = INFINITY;
+   }
+   free(args.energy);
+
+   /*
+    * The context which evaluated the best rotation stored its tour, so the
+    * result does not depend on the number of contexts.
+    */
+   for (int i = 0; i < contexts; i++)
+      if (best < (long) angles * (i + 1) / contexts)
+         return i;
+   return contexts - 1;
+}
+
+static void
+run_sweep(void *arg, int i)
+{
+   Sweep  *args = arg;
+   Context *ctx = args->ctx[i];
+
+   /*
+    * Every context sweeps a range of neighbouring rotations, so the cities 
+    * are only sorted a little further each time.
+    */
+   ctx->best_energy = INFINITY;
+   for (int j = (long) args->angles * i / args->contexts;
+        j < (long) args->angles * (i + 1) / args->contexts; j++) {
+      ctx->rotation = 2 * M_PI * j / args->angles;
+      args->energy[j] = renormalize_energy(ctx);
+      if (args->energy[j] < ctx->best_energy)
+         store_tour(ctx, args->energy[j]);
+   }
+}
+
+int
+parallel_tempering(Context ** ctx, int replicas, Pool * pool,
+                   unsigned long seed, int rounds, double temp_init,
+                   double temp_end, double initstate, double bm_sigma,
+                   FILE * log)
+{
+   Replicas args;
+   gsl_rng *swap_rng;
+   int     swaps;
+
+   assert(replicas > 0);
+
+   args.ctx = ctx;
+   args.temp_init = temp_init;
+   args.bm_sigma = bm_sigma;
+   if ((args.temp = calloc(replicas, sizeof(double))) == NULL ||
+       (args.energy = calloc(replicas, sizeof(double))) == NULL ||
+       (args.acpt_rng = calloc(replicas, sizeof(gsl_rng *))) == NULL)
+      errx(EX_OSERR, "Out of memory!");
+
+   /*
+    * The temperatures form a geometric ladder from temp_init down to 
+    * temp_end, the initial rotations are spread evenly over the circle.
+    */
+   for (int i = 0; i < replicas; i++) {
+      args.temp[i] = (replicas == 1) ? temp_init :
+          temp_init * pow(temp_end / temp_init, (double) i / (replicas - 1));
+
+      args.acpt_rng[i] = gsl_rng_alloc(gsl_rng_taus);
+      gsl_rng_set(args.acpt_rng[i], accept_seed(ctx[i]->seed));
+
+      ctx[i]->rotation = fmod(initstate + 2 * M_PI * i / replicas, 2 * M_PI);
+      args.energy[i] = renormalize_energy(ctx[i]);
+      store_tour(ctx[i], args.energy[i]);
+   }
+   swap_rng = gsl_rng_alloc(gsl_rng_taus);
+   gsl_rng_set(swap_rng, seed);
+
+   if (log != NULL)
+      (void) fprintf(log, "round E_b swaps\n");
+
+   for (int round = 0; round < rounds; round++) {
+      pool_run(pool, replicas, run_replica, &args);
+
+      /*
+       * Exchange the states of neighbouring temperatures with the Metropolis
+       * criterion, alternating the even and the odd pairs. This is done by
+       * one thread in a fixed order, so the run only depends on the seeds.
+       */
+      swaps = 0;
+      for (int i = round % 2; i + 1 < replicas; i += 2) {
+         double  delta = (1 / args.temp[i] - 1 / args.temp[i + 1]) *
+             (args.energy[i] - args.energy[i + 1]);
+
+         if (delta >= 0 || gsl_rng_uniform(swap_rng) < exp(delta)) {
+            double  rotation = ctx[i]->rotation;
+            double  energy = args.energy[i];
+
+            ctx[i]->rotation = ctx[i + 1]->rotation;
+            args.energy[i] = args.energy[i + 1];
+            ctx[i + 1]->rotation = rotation;
+            args.energy[i + 1] = energy;
+            swaps++;
+         }
+      }
+
+      if (log != NULL)
+         (void) fprintf(log, "%d %lf %d\n", round,
+                        ctx[best_context(ctx, replicas)]->best_energy, swaps);
+   }
+
+   for (int i = 0; i < replicas; i++)
+      gsl_rng_free(args.acpt_rng[i]);
+   gsl_rng_free(swap_rng);
+   free(args.acpt_rng);
+   free(args.energy);
+   free(args.temp);
+
+   return best_context(ctx, replicas);
+}
+
+static void
+run_replica(void *arg, int i)
+{
+   Replicas *args = arg;
+   Context *ctx = args->ctx[i];
+   double  temp = args->temp[i];
+
+   for (int step = 0; step < PT_STEPS; step++) {
+      double  rot_old = ctx->rotation;
+      double  energy_new, limit;
+
+      /*
+       * The step of the Brownian motion is proportional to the temperature 
+       * of the replica, so the coldest replica keeps moving as well.
+       */
+      neighbour_rot(ctx, temp, 0, args->temp_init, args->bm_sigma);
+
+      /*
+       * The Metropolis test only accepts an energy below limit, so the 
+       * route is abandoned as soon as it is known to be longer. An 
+       * abandoned route is longer than limit and so not better than the 
+       * state it was compared with, its returned bound is no energy and is 
+       * never stored.
+       */
+      limit = accept_limit(args->energy[i], temp, args->acpt_rng[i]);
+      energy_new = renormalize_bounded(ctx, limit);
+      if (energy_new < limit && energy_new < ctx->best_energy)
+         store_tour(ctx, energy_new);
+
+      if (energy_new < limit)
+         args->energy[i] = energy_new;
+      else
+         ctx->rotation = rot_old;
+   }
+}
+
+/*
+ * The first context with the shortest tour wins, so the result does not 
+ * depend on the order in which the threads finish.
+ */
+static int
+best_context(Context ** ctx, int num)
+{
+   int     best = 0;
+
+   for (int i = 1; i < num; i++)
+      if (ctx[i]->best_energy < ctx[best]->best_energy)
+         best = i;
+
+   return best;
+}
+
+/*
+ * The annealing leaves out ctx->coarse_levels of the levels of a complete 
+ * route at temp_init, and one level less for every equal step of the 
+ * logarithm of the temperature, down to the complete route at temp_end. Hot
+ * steps only explore, so they are evaluated on a coarser route.
+ */
+static unsigned int
+anneal_depth(const Context * ctx, unsigned int levels, double temp,
+             double temp_init, double temp_end)
+{
+   double  heat;
+   long    coarse;
+
+   if (ctx->coarse_levels <= 0 || temp <= temp_end || temp_init <= temp_end)
+      return MAX_LEVEL;
+
+   heat = log(temp / temp_end) / log(temp_init / temp_end);
+   coarse = lround(ctx->coarse_levels * fmin(heat, 1.0));
+   if (coarse <= 0)
+      return MAX_LEVEL;
+   return (coarse < levels) ? levels - coarse : 1;
+}
+
+/*
+ * The Brownian motion is seeded with the seed of the context itself. Both
+ * streams draw one number every step, so with the same seed the step and the
+ * Metropolis test would be the same number. The seed is scrambled with the
+ * finalizer of SplitMix64.
+ */
+static unsigned long
+accept_seed(unsigned long seed)
+{
+   uint64_t z = (uint64_t) seed + 0x9E3779B97F4A7C15ULL;
+
+   z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+   z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+   return (unsigned long) (z ^ (z >> 31));
+}
+
+/*
+ * A state of energy e is accepted with probability exp(-(e - energy) / temp),
+ * so it is accepted if it is below energy - temp * log(u), for a uniform 
+ * random number u.
+ */
+static double
+accept_limit(double energy, double temp, gsl_rng * rng)
+{
+   return energy - temp * log(gsl_rng_uniform(rng));
+}
+
+double
+rotation_scan(Context * ctx, double from, double to, FILE * log)
+{
+   double  rotation = from, lo, hi, mid;
+   uint64_t sign, next, probe;
+
+   ctx->best_energy = INFINITY;
+   ctx->rotation = rotation;
+   sort_cities(ctx);
+   sign = grid_signature(ctx, ctx->leaf_cities);
+   scan_grid(ctx, log);
+
+   while (rotation < to) {
+      /*
+       * The step is only an estimate, and it ends at to at the latest. If
+       * the grid at its end differs from the one just evaluated, the step
+       * is halved down to SCAN_MIN_STEP, towards the first rotation at which
+       * the grid changes. Grids which differ by less than SCAN_MIN_STEP are
+       * not told apart.
+       */
+      lo = rotation;
+      hi = fmin(rotation + rotation_step(ctx, ctx->leaf_cities) *
+                (1 + SCAN_OVERSHOOT) + SCAN_MIN_STEP, to);
+      ctx->rotation = hi;
+      sort_cities(ctx);
+      next = grid_signature(ctx, ctx->leaf_cities);
+      if (next == sign) {
+         rotation = hi;
+         continue;
+      }
+
+      while (hi - lo > SCAN_MIN_STEP) {
+         mid = lo + (hi - lo) / 2;
+         ctx->rotation = mid;
+         sort_cities(ctx);
+         if ((probe = grid_signature(ctx, ctx->leaf_cities)) == sign)
+            lo = mid;
+         else {
+            hi = mid;
+            next = probe;
+         }
+      }
+      if (hi >= to)
+         break;
+
+      rotation = hi;
+      sign = next;
+      ctx->rotation = rotation;
+      sort_cities(ctx);
+      scan_grid(ctx, log);
+   }
+
+   return ctx->best_energy;
+}
+
+static void
+scan_grid(Context * ctx, FILE * log)
+{
+   double  energy = renormalize_energy(ctx);
+
+   if (energy < ctx->best_energy)
+      store_tour(ctx, energy);
+   if (log != NULL)
+      (void) fprintf(log, "%lf %lf\n", ctx->rotation, energy);
+}
+
+static void
+store_tour(Context * ctx, double energy)
+{
+   memcpy(ctx->tour, renormalize(ctx, NULL),
+          ctx->tsp->dimension * sizeof(int));
+   ctx->best_energy = energy;
+   ctx->best_rotation = ctx->rotation;
+}
+
+/*
+ * The rotation walks over the whole circle. A quarter turn only transposes
+ * and mirrors the grid, but the routes of the route table break ties by
+ * their orientation, so the four rotations of a grid give different routes.
+ * Their lengths differ by several percent, so they are not folded into one.
+ */
 double
-neighbour_rot(double temp, double temp_end, double temp_init, double bm_sigma)
+neighbour_rot(Context * ctx, double temp, double temp_end, double temp_init,
+              double bm_sigma)
 {
    const double BM_start = 2 * M_PI;
 
     double BM = BM_start *
        (bm_sigma * (temp - temp_end) /
            (temp_init - temp_end)) *
-           gsl_cdf_gaussian_Pinv(gsl_rng_uniform(_bm_rng), 1);
+           gsl_cdf_gaussian_Pinv(gsl_rng_uniform(ctx->bm_rng), 1);
    if (isinf(BM))
         BM = MAXFLOAT;
 
-   rotation = fmod(fabs(rotation + BM), 2 * M_PI);
+   ctx->rotation = fmod(fabs(ctx->rotation + BM), 2 * M_PI);
 
    return BM;
 }
@@ -1,8 +1,88 @@
 #ifndef SA_H
 #define SA_H
 
+#include <stdio.h>
+
+#include "tsp.h"
+#include "pool.h"
+
+/*
+ * Anneal the rotation of ctx, the best tour is stored in ctx->tour and its
+ * length is returned. The random numbers follow from the seed of ctx.
+ */
 double
-thermo_sa(double temp_init, double temp_end, double temp_sig, double initstate, 
+thermo_sa(Context * ctx, double temp_init, double temp_end, double temp_sig,
+		double initstate, double bm_sigma, double k, FILE *log);
+
+/*
+ * The same annealing as thermo_sa(), but every step batch candidate 
+ * rotations are proposed and evaluated at the same time, on the threads of
+ * pool with one of the helpers for each candidate. They are accepted or
+ * rejected in the order in which they are proposed, so the result does not
+ * depend on the number of threads.
+ */
+double
+thermo_sa_batch(Context * ctx, Context ** helpers, int batch, Pool * pool,
+		double temp_init, double temp_end, double temp_sig, double initstate,
 		double bm_sigma, double k, FILE *log);
 
+/*
+ * Run chains independent annealings on the threads of pool, one for each of
+ * the contexts in ctx. Every context needs its own seed. Returns the index 
+ * of the context with the shortest tour, which is the same for every number
+ * of threads.
+ */
+int
+thermo_sa_chains(Context ** ctx, int chains, Pool * pool, double temp_init,
+		double temp_end, double temp_sig, double initstate, double bm_sigma,
+		double k, FILE *log);
+
+/*
+ * The same as thermo_sa_chains(), but chain i starts at rotation starts[i].
+ */
+int
+thermo_sa_starts(Context ** ctx, int chains, Pool * pool, double temp_init,
+		double temp_end, double temp_sig, const double *starts, double bm_sigma,
+		double k, FILE *log);
+
+/*
+ * Parallel tempering of the rotation. The replicas, one for each of the 
+ * contexts in ctx, walk at a geometric ladder of temperatures from temp_init
+ * down to temp_end on the threads of pool. After every few steps the states
+ * of neighbouring temperatures are exchanged with the Metropolis criterion,
+ * with random numbers which follow from seed. Returns the index of the 
+ * context with the shortest tour after rounds exchanges.
+ */
+int
+parallel_tempering(Context ** ctx, int replicas, Pool * pool,
+		unsigned long seed, int rounds, double temp_init, double temp_end,
+		double initstate, double bm_sigma, FILE *log);
+
+/*
+ * Evaluate the grids of the rotations from up to to, stepping from one grid
+ * to the next with rotation_step(). A step which ends on another grid, see
+ * grid_signature(), is halved until it ends right after the rotation at 
+ * which the grid changes, and that grid is evaluated. The best tour is 
+ * stored in ctx->tour and its length is returned. If log is not NULL the 
+ * energy of every grid is written to it.
+ *
+ * The scan samples the grids, it does not enumerate them: a grid which
+ * changes and changes back within one step is not seen. The energy of a grid
+ * is only constant when no leaves are solved, ctx->leaf_cities below 2, as
+ * the path through a leaf follows the rotation itself.
+ */
+double
+rotation_scan(Context * ctx, double from, double to, FILE *log);
+
+/*
+ * Evaluate angles evenly spaced rotations of the whole circle on the threads
+ * of pool, each of the contexts in ctx taking a range of them. If log is 
+ * not NULL the energy profile is written to it. The num_starts rotations of the lowest energies
+ * are stored in starts, the lowest first. Returns the index of the context 
+ * with the shortest tour, which is the same for every number of contexts.
+ */
+int
+rotation_sweep(Context ** ctx, int contexts, Pool * pool, int angles,
+		double *starts, int num_starts, FILE *log);
+
 #endif
@@ -0,0 +1,518 @@
+/* fseeko() and ftello(), the tile file can be larger than a long. */
+#define _POSIX_C_SOURCE 200809L
+
+#include <err.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sysexits.h>
+#include <assert.h>
+#include <math.h>
+#include <sys/types.h>
+
+#include "tile.h"
+#include "io.h"
+#include "block.h"
+#include "context.h"
+#include "renormalization.h"
+#include "routes.h"
+
+/* The number of cities which are read before they are spilled at once. */
+#define TILE_CHUNK (1 << 20)
+
+/*
+ * Below this number of cities the cities are taken in the order in which
+ * they are given, every order is as long.
+ */
+#define TILE_TRIVIAL 4
+
+/* A rotated city in the tile file. */
+typedef struct
+{
+   int     city;
+   double  x;
+   double  y;
+} Spilled;
+
+/* The tiles of the rotated plane, and the tile file with their cities. */
+typedef struct
+{
+   int     dimension;
+   off_t   start;
+   unsigned int side;
+   double  cos_rot;
+   double  sin_rot;
+   double  x_min;
+   double  y_min;
+   double  x_step;
+   double  y_step;
+   /*
+    * For every tile the number of its cities, the first of them in the tile
+    * file and the sum of their coordinates.
+    */
+   int    *count;
+   off_t  *first;
+   double *sum_x;
+   double *sum_y;
+   FILE   *spill;
+} Tiles;
+
+/* The tour as far as it is written. */
+typedef struct
+{
+   FILE   *out;
+   Length  length;
+   int     written;
+   double  first_x;
+   double  first_y;
+   double  last_x;
+   double  last_y;
+} Tour;
+
+/* Read the next city of the tsp file, rotated. */
+static void read_city(FILE * in, const Tiles * tiles, Spilled * city);
+/* Find the limits of the rotated plane and the size of the tiles. */
+static void read_limits(FILE * in, Tiles * tiles);
+/* Count the cities of every tile, and find their centers of mass. */
+static void count_cities(FILE * in, Tiles * tiles);
+/* Write the cities to the tile file, ordered by tile. */
+static void spill_cities(FILE * in, Tiles * tiles);
+/* Returns the tile of a rotated city. */
+static unsigned int tile_of(const Tiles * tiles, double x, double y);
+/* Returns the order of the occupied tiles, of which there are *occupied. */
+static int *tile_route(const Tiles * tiles, int *occupied, int leaf_cities,
+                       int threads);
+/*
+ * Returns a route through the n cities at (x, y), which enters their plane 
+ * at the border point entry and departs at departure. The route is closed if
+ * entry is NO_NODE.
+ */
+static int *solve_cities(double *x, double *y, int n, int entry,
+                         int departure, int leaf_cities, int threads);
+/*
+ * Returns the border point of the plane of the n cities at (x, y) which is
+ * closest to (to_x, to_y), other than the border point skip.
+ */
+static int border_point(const double *x, const double *y, int n, double to_x,
+                        double to_y, int skip);
+/* Write the cities of a tile in the order of their route. */
+static void write_tile(Tour * tour, const Spilled * cities, const int *route,
+                       int n);
+
+double
+solve_tiled(FILE * in, FILE * out, int tile_cities, double rotation,
+            int leaf_cities, int threads)
+{
+   Tsp    *header;
+   Tiles   tiles;
+   Tour    tour;
+   unsigned int level = 0;
+   int    *route, occupied, max_count = 0;
+   Spilled *cities;
+   double *x, *y;
+
+   assert(in != NULL && out != NULL);
+   assert(tile_cities > 0);
+
+   header = import_header(in);
+   tiles.dimension = header->dimension;
+   tiles.cos_rot = cos(rotation);
+   tiles.sin_rot = sin(rotation);
+   if ((tiles.start = ftello(in)) < 0)
+      errx(EX_USAGE, "The tsp file can not be read more than once");
+
+   /*
+    * The tiles are the cells of the first level of the grid at which they
+    * hold tile_cities cities on average.
+    */
+   tiles.side = 1;
+   while (level < MAX_LEVEL && (double) tiles.dimension /
+          ((double) tiles.side * tiles.side) > tile_cities) {
+      tiles.side *= CELL_SIDE;
+      level++;
+   }
+
+   size_t  num_tiles = (size_t) tiles.side * tiles.side;
+
+   if ((tiles.count = calloc(num_tiles, sizeof(int))) == NULL ||
+       (tiles.first = calloc(num_tiles, sizeof(off_t))) == NULL ||
+       (tiles.sum_x = calloc(num_tiles, sizeof(double))) == NULL ||
+       (tiles.sum_y = calloc(num_tiles, sizeof(double))) == NULL)
+      errx(EX_OSERR, "Not enough memory!");
+   if ((tiles.spill = tmpfile()) == NULL)
+      errx(EX_CANTCREAT, "Unable to create the tile file");
+
+   /*
+    * The file is read three times, the cities are spilled at the place of
+    * their tile, which follows from the counts of the tiles, which follow
+    * from the limits of the plane.
+    */
+   read_limits(in, &tiles);
+   count_cities(in, &tiles);
+   spill_cities(in, &tiles);
+
+   route = tile_route(&tiles, &occupied, leaf_cities, threads);
+   warnx("Solving %d tiles at level %u", occupied, level);
+
+   for (int k = 0; k < occupied; k++)
+      if (tiles.count[route[k]] > max_count)
+         max_count = tiles.count[route[k]];
+   if ((cities = calloc(max_count, sizeof(Spilled))) == NULL ||
+       (x = calloc(max_count, sizeof(double))) == NULL ||
+       (y = calloc(max_count, sizeof(double))) == NULL)
+      errx(EX_OSERR, "Not enough memory!");
+
+   (void) fprintf(out, "NAME : %s.tour\nTYPE : TOUR\nDIMENSION : %d\n"
+                  "TOUR_SECTION\n", header->name, tiles.dimension);
+
+   /*
+    * The first tile is entered from the last one.
+    */
+   int     last = route[occupied - 1];
+
+   tour.out = out;
+   tour.length.sum = tour.length.comp = 0;
+   tour.written = 0;
+   tour.last_x = tiles.sum_x[last] / tiles.count[last];
+   tour.last_y = tiles.sum_y[last] / tiles.count[last];
+   tour.first_x = tour.last_x;
+   tour.first_y = tour.last_y;
+
+   for (int k = 0; k < occupied; k++) {
+      int     tile = route[k], next = route[(k + 1) % occupied];
+      int     n = tiles.count[tile];
+      double  next_x = tiles.sum_x[next] / tiles.count[next];
+      double  next_y = tiles.sum_y[next] / tiles.count[next];
+
+      if (fseeko(tiles.spill, tiles.first[tile] * (off_t) sizeof(Spilled),
+                 SEEK_SET) != 0 ||
+          fread(cities, sizeof(Spilled), n, tiles.spill) != (size_t) n)
+         errx(EX_IOERR, "Unable to read the tile file");
+
+      for (int i = 0; i < n; i++) {
+         x[i] = cities[i].x;
+         y[i] = cities[i].y;
+      }
+
+      /*
+       * The last tile leads back to the first city of the tour.
+       */
+      if (k == occupied - 1 && tour.written > 0) {
+         next_x = tour.first_x;
+         next_y = tour.first_y;
+      }
+
+      /*
+       * The tile is solved as a path from the border point closest to the
+       * end of the tour so far to the border point closest to the next tile.
+       * A single tile is the whole tour, which is closed.
+       */
+      int     entry = NO_NODE, departure = NO_NODE;
+
+      if (occupied > 1) {
+         entry = border_point(x, y, n, tour.last_x, tour.last_y, NO_NODE);
+         departure = border_point(x, y, n, next_x, next_y, entry);
+      }
+      int    *path = solve_cities(x, y, n, entry, departure, leaf_cities,
+                                  threads);
+
+      write_tile(&tour, cities, path, n);
+      free(path);
+   }
+
+   add_length(&tour.length, hypot(tour.last_x - tour.first_x,
+                                  tour.last_y - tour.first_y));
+   (void) fprintf(out, "-1\nEOF\n");
+   if (fflush(out) != 0)
+      errx(EX_IOERR, "Unable to write the tour");
+
+   (void) fclose(tiles.spill);
+   free(tiles.count);
+   free(tiles.first);
+   free(tiles.sum_x);
+   free(tiles.sum_y);
+   free(route);
+   free(cities);
+   free(x);
+   free(y);
+   free(header);
+
+   return total_length(&tour.length);
+}
+
+static void
+read_city(FILE * in, const Tiles * tiles, Spilled * city)
+{
+   double  x, y;
+
+   if (!import_city(in, &city->city, &x, &y))
+      errx(EX_DATAERR, "Fewer cities than the dimension");
+   if (city->city < 1 || city->city > tiles->dimension)
+      errx(EX_DATAERR, "Incorrect city index");
+
+   city->city--;
+   city->x = x * tiles->cos_rot + y * tiles->sin_rot;
+   city->y = -x * tiles->sin_rot + y * tiles->cos_rot;
+}
+
+static void
+read_limits(FILE * in, Tiles * tiles)
+{
+   double  limits[4] = { INFINITY, -INFINITY, INFINITY, -INFINITY };
+   Spilled city;
+
+   if (fseeko(in, tiles->start, SEEK_SET) != 0)
+      errx(EX_IOERR, "Unable to read the tsp file");
+
+   for (int i = 0; i < tiles->dimension; i++) {
+      read_city(in, tiles, &city);
+      limits[0] = fmin(limits[0], city.x);
+      limits[1] = fmax(limits[1], city.x);
+      limits[2] = fmin(limits[2], city.y);
+      limits[3] = fmax(limits[3], city.y);
+   }
+
+   /*
+    * The same margins as the grid of a context.
+    */
+   tiles->x_min = limits[0] - X_MARGIN;
+   tiles->y_min = limits[2] - Y_MARGIN;
+   tiles->x_step = (limits[1] + X_MARGIN - tiles->x_min) / tiles->side;
+   tiles->y_step = (limits[3] + Y_MARGIN - tiles->y_min) / tiles->side;
+}
+
+static void
+count_cities(FILE * in, Tiles * tiles)
+{
+   size_t  num_tiles = (size_t) tiles->side * tiles->side;
+   off_t   first = 0;
+   Spilled city;
+
+   if (fseeko(in, tiles->start, SEEK_SET) != 0)
+      errx(EX_IOERR, "Unable to read the tsp file");
+
+   for (int i = 0; i < tiles->dimension; i++) {
+      read_city(in, tiles, &city);
+
+      unsigned int tile = tile_of(tiles, city.x, city.y);
+
+      tiles->count[tile]++;
+      tiles->sum_x[tile] += city.x;
+      tiles->sum_y[tile] += city.y;
+   }
+
+   for (size_t t = 0; t < num_tiles; t++) {
+      tiles->first[t] = first;
+      first += tiles->count[t];
+   }
+}
+
+static void
+spill_cities(FILE * in, Tiles * tiles)
+{
+   size_t  num_tiles = (size_t) tiles->side * tiles->side;
+   Spilled *chunk, *sorted;
+   unsigned int *chunk_tile;
+   int    *run, *next;
+   off_t  *spilled;
+
+   if ((chunk = calloc(TILE_CHUNK, sizeof(Spilled))) == NULL ||
+       (sorted = calloc(TILE_CHUNK, sizeof(Spilled))) == NULL ||
+       (chunk_tile = calloc(TILE_CHUNK, sizeof(unsigned int))) == NULL ||
+       (run = calloc(num_tiles, sizeof(int))) == NULL ||
+       (next = calloc(num_tiles, sizeof(int))) == NULL ||
+       (spilled = calloc(num_tiles, sizeof(off_t))) == NULL)
+      errx(EX_OSERR, "Not enough memory!");
+
+   if (fseeko(in, tiles->start, SEEK_SET) != 0)
+      errx(EX_IOERR, "Unable to read the tsp file");
+
+   for (int done = 0; done < tiles->dimension;) {
+      int     size = tiles->dimension - done;
+
+      if (size > TILE_CHUNK)
+         size = TILE_CHUNK;
+
+      for (int i = 0; i < size; i++) {
+         read_city(in, tiles, &chunk[i]);
+         chunk_tile[i] = tile_of(tiles, chunk[i].x, chunk[i].y);
+         run[chunk_tile[i]]++;
+      }
+
+      /*
+       * Sort the chunk on the tiles, and append the run of every tile to the
+       * cities of the tile which are spilled already.
+       */
+      int     first = 0;
+
+      for (size_t t = 0; t < num_tiles; t++) {
+         next[t] = first;
+         first += run[t];
+      }
+      for (int i = 0; i < size; i++)
+         sorted[next[chunk_tile[i]]++] = chunk[i];
+
+      for (size_t t = 0; t < num_tiles; t++) {
+         if (run[t] == 0)
+            continue;
+         if (fseeko(tiles->spill, (tiles->first[t] + spilled[t]) *
+                    (off_t) sizeof(Spilled), SEEK_SET) != 0 ||
+             fwrite(sorted + next[t] - run[t], sizeof(Spilled), run[t],
+                    tiles->spill) != (size_t) run[t])
+            errx(EX_IOERR, "Unable to write the tile file");
+         spilled[t] += run[t];
+         run[t] = 0;
+      }
+      done += size;
+   }
+
+   free(chunk);
+   free(sorted);
+   free(chunk_tile);
+   free(run);
+   free(next);
+   free(spilled);
+}
+
+static unsigned int
+tile_of(const Tiles * tiles, double x, double y)
+{
+   double  max_cell = (double) (tiles->side - 1);
+   double  cell_x = floor((x - tiles->x_min) / tiles->x_step);
+   double  cell_y = floor((y - tiles->y_min) / tiles->y_step);
+
+   if (cell_x > max_cell)
+      cell_x = max_cell;
+   if (cell_y > max_cell)
+      cell_y = max_cell;
+
+   return (unsigned int) cell_y * tiles->side + (unsigned int) cell_x;
+}
+
+static int *
+tile_route(const Tiles * tiles, int *occupied, int leaf_cities, int threads)
+{
+   size_t  num_tiles = (size_t) tiles->side * tiles->side;
+   int    *tile, *order, *route;
+   double *x, *y;
+   int     m = 0;
+
+   if ((tile = calloc(num_tiles, sizeof(int))) == NULL ||
+       (x = calloc(num_tiles, sizeof(double))) == NULL ||
+       (y = calloc(num_tiles, sizeof(double))) == NULL)
+      errx(EX_OSERR, "Not enough memory!");
+
+   /*
+    * Every occupied tile is represented by the center of mass of its
+    * cities, which lies within the tile.
+    */
+   for (size_t t = 0; t < num_tiles; t++)
+      if (tiles->count[t] > 0) {
+         tile[m] = (int) t;
+         x[m] = tiles->sum_x[t] / tiles->count[t];
+         y[m] = tiles->sum_y[t] / tiles->count[t];
+         m++;
+      }
+
+   order = solve_cities(x, y, m, NO_NODE, NO_NODE, leaf_cities, threads);
+   if ((route = calloc(m, sizeof(int))) == NULL)
+      errx(EX_OSERR, "Not enough memory!");
+   for (int k = 0; k < m; k++)
+      route[k] = tile[order[k]];
+
+   free(order);
+   free(tile);
+   free(x);
+   free(y);
+
+   *occupied = m;
+   return route;
+}
+
+static int *
+solve_cities(double *x, double *y, int n, int entry, int departure,
+             int leaf_cities, int threads)
+{
+   int    *tour;
+
+   if ((tour = calloc(n, sizeof(int))) == NULL)
+      errx(EX_OSERR, "Not enough memory!");
+
+   if (n < TILE_TRIVIAL) {
+      for (int i = 0; i < n; i++)
+         tour[i] = i;
+      return tour;
+   }
+
+   Tsp     tsp = {.dimension = n,.distance_type = EUC_2D,.x = x,.y = y };
+   Context *ctx = create_context(&tsp);
+
+   ctx->leaf_cities = leaf_cities;
+   ctx->entry = entry;
+   ctx->departure = departure;
+   context_threads(ctx, threads);
+   memcpy(tour, renormalize(ctx, NULL), n * sizeof(int));
+   free_context(ctx);
+
+   return tour;
+}
+
+static int
+border_point(const double *x, const double *y, int n, double to_x,
+             double to_y, int skip)
+{
+   double  limits[4] = { INFINITY, -INFINITY, INFINITY, -INFINITY };
+   double  best = INFINITY;
+   int     point = NO_NODE;
+
+   for (int i = 0; i < n; i++) {
+      limits[0] = fmin(limits[0], x[i]);
+      limits[1] = fmax(limits[1], x[i]);
+      limits[2] = fmin(limits[2], y[i]);
+      limits[3] = fmax(limits[3], y[i]);
+   }
+
+   /*
+    * The plane of the cities has the same margins as the grid of a context,
+    * and the positions of the border points are in half subcells.
+    */
+   double  x_min = limits[0] - X_MARGIN;
+   double  y_min = limits[2] - Y_MARGIN;
+   double  x_unit = (limits[1] + X_MARGIN - x_min) / (2 * CELL_SIDE);
+   double  y_unit = (limits[3] + Y_MARGIN - y_min) / (2 * CELL_SIDE);
+
+   for (int node = NODE_BORDER_TL; node <= NODE_BORDER_BR; node++) {
+      int     px, py;
+      double  distance;
+
+      if (node == skip)
+         continue;
+      node_position(node, &px, &py);
+      distance = hypot(x_min + px * x_unit - to_x, y_min + py * y_unit - to_y);
+      if (distance < best) {
+         best = distance;
+         point = node;
+      }
+   }
+   return point;
+}
+
+static void
+write_tile(Tour * tour, const Spilled * cities, const int *route, int n)
+{
+   for (int i = 0; i < n; i++) {
+      const Spilled *city = &cities[route[i]];
+
+      if (tour->written == 0) {
+         tour->first_x = city->x;
+         tour->first_y = city->y;
+      } else
+         add_length(&tour->length, hypot(tour->last_x - city->x,
+                                         tour->last_y - city->y));
+      tour->last_x = city->x;
+      tour->last_y = city->y;
+      tour->written++;
+
+      (void) fprintf(tour->out, "%d\n", city->city + 1);
+   }
+}
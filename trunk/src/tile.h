@@ -0,0 +1,26 @@
+#ifndef TILE_H
+#define TILE_H
+
+#include <stdio.h>
+
+/* The default number of cities of a tile. */
+#define TILE_CITIES (1 << 20)
+
+/*
+ * Solve the tsp file in without holding all its cities in memory. The plane,
+ * rotated by rotation, is split in the cells of one level of the grid, the
+ * tiles, so that a tile holds about tile_cities cities. The cities are
+ * spilled to a temporary file ordered by tile. A route through the tiles is
+ * renormalized from their centers of mass, after which the cities of every
+ * tile are read back and renormalized as an open path. The path enters the 
+ * plane of the tile at the border point closest to the end of the previous 
+ * tile and departs at the border point closest to the center of the next 
+ * one, a single tile is solved as a closed tour. The tour is
+ * written to out in the TSPLIB format while the tiles are solved, and its
+ * length is returned. The tiles are solved with leaf_cities and threads as
+ * in the context of the solver.
+ */
+double  solve_tiled(FILE * in, FILE * out, int tile_cities, double rotation,
+                    int leaf_cities, int threads);
+
+#endif /* TILE_H */
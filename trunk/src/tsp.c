@@ -1,6 +1,7 @@
 #include <sysexits.h>
 #include <stdlib.h>
 #include <stdio.h>
+#include <string.h>
 #include <math.h>
 #include <err.h>
 #include <unistd.h>
@@ -13,6 +14,9 @@
 #include "block.h"
 #include "tsp.h"
 #include "sa.h"
+#include "pool.h"
+#include "context.h"
+#include "tile.h"
 #include <config.h>
 
 #ifndef M_PI
@@ -23,8 +27,6 @@
  */
 static void usage(void);
 
-Tsp    *tsp;
-
 int
 main(int argc, char *argv[])
 {
@@ -32,9 +34,22 @@ main(int argc, char *argv[])
 	double  bm_sigma = 0.2, temp_end = 1, temp_init = 100, init_state = 0;
 	double  k = 0;
    FILE   *toimport = NULL;
+   Tsp    *tsp;
+   Context **ctx;
+   Pool   *pool;
+   int     threads = 1, route_threads = 1, replicas = 8, rounds = 1000;
+   int     candidates = 1, leaf_cities = LEAF_CITIES, coarse_levels = 0;
+   int     cache_entries = 0, angles = 1000, num_starts = 0;
+   double *starts = NULL;
+   int     tile_cities = TILE_CITIES;
+   char   *tour_file = NULL;
+   FILE   *tour_out = stdout;
+   int     contexts, best;
+   unsigned long seed = 0;
+   enum { MODE_SA, MODE_PT, MODE_SCAN, MODE_SWEEP, MODE_TILED } mode = MODE_SA;
 	FILE	 *log = NULL;
 
-   while ((ch = getopt(argc, argv, "f:i:s:e:b:k:l:?h")) != -1)
+   while ((ch = getopt(argc, argv, "f:i:s:e:b:k:l:j:t:r:m:p:n:c:x:d:a:w:g:o:z:?h")) != -1)
       switch (ch) {
       case 'l':
          if ((log = fopen(optarg, "w")) == NULL)
@@ -64,6 +79,71 @@ main(int argc, char *argv[])
   		case 'k':
          if ((k = strtod(optarg, &ep)) <= 0)
             usage();
+         break;
+      case 'j':
+         if ((threads = (int) strtol(optarg, &ep, 10)) <= 0)
+            usage();
+         break;
+      case 't':
+         if ((route_threads = (int) strtol(optarg, &ep, 10)) <= 0)
+            usage();
+         break;
+      case 'r':
+         seed = strtoul(optarg, &ep, 10);
+         break;
+      case 'm':
+         if (strcmp(optarg, "sa") == 0)
+            mode = MODE_SA;
+         else if (strcmp(optarg, "pt") == 0)
+            mode = MODE_PT;
+         else if (strcmp(optarg, "scan") == 0)
+            mode = MODE_SCAN;
+         else if (strcmp(optarg, "sweep") == 0)
+            mode = MODE_SWEEP;
+         else if (strcmp(optarg, "tiled") == 0)
+            mode = MODE_TILED;
+         else
+            usage();
+         break;
+      case 'p':
+         if ((replicas = (int) strtol(optarg, &ep, 10)) <= 0)
+            usage();
+         break;
+      case 'n':
+         if ((rounds = (int) strtol(optarg, &ep, 10)) <= 0)
+            usage();
+         break;
+      case 'c':
+         if ((candidates = (int) strtol(optarg, &ep, 10)) <= 0)
+            usage();
+         break;
+      case 'a':
+         if ((cache_entries = (int) strtol(optarg, &ep, 10)) < 0)
+            usage();
+         break;
+      case 'd':
+         if ((coarse_levels = (int) strtol(optarg, &ep, 10)) < 0)
+            usage();
+         break;
+      case 'w':
+         if ((angles = (int) strtol(optarg, &ep, 10)) <= 0)
+            usage();
+         break;
+      case 'g':
+         if ((num_starts = (int) strtol(optarg, &ep, 10)) < 0)
+            usage();
+         break;
+      case 'o':
+         tour_file = optarg;
+         break;
+      case 'z':
+         if ((tile_cities = (int) strtol(optarg, &ep, 10)) <= 0)
+            usage();
+         break;
+      case 'x':
+         leaf_cities = (int) strtol(optarg, &ep, 10);
+         if (leaf_cities < 0 || leaf_cities > LEAF_MAX)
+            usage();
          break;
 		case '?':
       case 'h':
@@ -75,6 +155,22 @@ main(int argc, char *argv[])
 		warnx("No import file!");
       usage();
 	}
+	if (num_starts > angles) {
+		warnx("The number of starts must not exceed the number of angles.");
+		usage();
+	}
+	if (mode == MODE_SCAN && leaf_cities >= 2) {
+		warnx("The scan can only be used when leaves are not solved, use -x 1.");
+		usage();
+	}
+	if (cache_entries > 0 && leaf_cities >= 2) {
+		warnx("Routes can only be cached when leaves are not solved, use -x 1.");
+		usage();
+	}
+	if (tour_file != NULL && mode != MODE_TILED) {
+		warnx("A tour file can only be written in the tiled mode.");
+		usage();
+	}
 	if (temp_end > temp_init) {
 		warnx("The end temperature must be smaller than the begin temperature.");
 		usage();
@@ -87,15 +183,94 @@ end temp %04.2lf Brownian motion sigma %lf", init_state, temp_init, temp_end,
    argc -= optind;
    argv += optind;
 
-	/* Load and initialize the tsp data set for the renormalization. */
+	/*
+	 * The tiled mode streams the cities of the data set, and writes the tour
+	 * while it is solved.
+	 */
+	if (mode == MODE_TILED) {
+		if (tour_file != NULL && (tour_out = fopen(tour_file, "w")) == NULL)
+			errx(EX_CANTCREAT, "Unable to open file %s", tour_file);
+
+		double  length = solve_tiled(toimport, tour_out, tile_cities,
+				init_state, leaf_cities, route_threads);
+
+		warnx("Tour of length %lf written", length);
+		fclose(toimport);
+		if (tour_out != stdout)
+			fclose(tour_out);
+		return EX_OK;
+	}
+
+	/* Load the tsp data set for the renormalization. */
    tsp = import_tsp(toimport);
-   preprocess_routes();
    fclose(toimport);
 
-	double energy = thermo_sa(temp_init, temp_end, 0.01, init_state, bm_sigma, 
-			k, log);
-	warnx("Best energy found %lf", energy);
-	fclose(log);
+	/* 
+	 * Every chain or replica gets its own context and seed, a chain which 
+	 * evaluates several candidates at once needs a context for each of them.
+	 */
+   if (mode == MODE_PT)
+      contexts = replicas;
+   else if (mode == MODE_SCAN)
+      contexts = 1;
+   else if (mode == MODE_SWEEP)
+      contexts = (num_starts > threads) ? num_starts : threads;
+   else if (candidates > 1)
+      contexts = 1 + candidates;
+   else
+      contexts = threads;
+   pool = create_pool(threads);
+   if ((ctx = calloc(contexts, sizeof(Context *))) == NULL)
+      errx(EX_OSERR, "Not enough memory!");
+   for (int i = 0; i < contexts; i++) {
+      ctx[i] = create_context(tsp);
+      seed_context(ctx[i], seed + i);
+      context_threads(ctx[i], route_threads);
+      ctx[i]->leaf_cities = leaf_cities;
+      ctx[i]->coarse_levels = coarse_levels;
+      context_cache(ctx[i], cache_entries);
+   }
+
+	if (mode == MODE_PT)
+		best = parallel_tempering(ctx, replicas, pool, seed + replicas, rounds,
+				temp_init, temp_end, init_state, bm_sigma, log);
+	else if (mode == MODE_SCAN) {
+		rotation_scan(ctx[0], 0, 2 * M_PI, log);
+		best = 0;
+	} else if (mode == MODE_SWEEP) {
+		/*
+		 * The log holds the energy profile of the sweep, the annealings from
+		 * the best rotations of the sweep are not logged.
+		 */
+		if ((starts = calloc(num_starts + 1, sizeof(double))) == NULL)
+			errx(EX_OSERR, "Not enough memory!");
+		best = rotation_sweep(ctx, contexts, pool, angles, starts, num_starts,
+				log);
+		if (num_starts > 0)
+			best = thermo_sa_starts(ctx, num_starts, pool, temp_init, temp_end,
+					0.01, starts, bm_sigma, k, NULL);
+		free(starts);
+	} else if (candidates > 1) {
+		thermo_sa_batch(ctx[0], ctx + 1, candidates, pool, temp_init, temp_end,
+				0.01, init_state, bm_sigma, k, log);
+		best = 0;
+	} else
+		best = thermo_sa_chains(ctx, threads, pool, temp_init, temp_end, 0.01,
+				init_state, bm_sigma, k, log);
+	/*
+	 * The length of the tour itself is measured again, as a check on the
+	 * energy.
+	 */
+	warnx("Best energy found %lf at rotation %lf, tour length %lf",
+			ctx[best]->best_energy, ctx[best]->best_rotation,
+			route_length(ctx[best], ctx[best]->tour, tsp->dimension));
+	if (log != NULL)
+		fclose(log);
+
+   for (int i = 0; i < contexts; i++)
+      free_context(ctx[i]);
+   free(ctx);
+   free_pool(pool);
 
    return EX_OK;
 }
@@ -105,7 +280,10 @@ usage(void)
 {
    (void) fprintf(stderr,
                   "usage tsp -f [filename] -i [initstate] -s [BM sigma] \
--e [end temp] -b [begin temp] -l [log file]\n");
+-e [end temp] -b [begin temp] -l [log file] -j [threads] -t [threads] \
+-r [seed] -m [mode] -p [replicas] -n [rounds] -c [candidates] \
+-x [cities] -d [levels] -a [entries] -w [angles] -g [starts] \
+-o [tour file] -z [cities]\n");
    (void) fprintf(stderr, "-f [filename]    The filename from which \
 the distances should be loaded.\n");
    (void) fprintf(stderr, "-l [log file]    The filename where the \
@@ -118,6 +296,40 @@ motion (default 0.2)\n");
 of the TSA (default 100)\n");
    (void) fprintf(stderr, "-e [end temp]    The end temperature \
 of the TSA (default 1)\n");
+   (void) fprintf(stderr, "-j [threads]     The number of threads, in sa \
+mode each runs an independent annealing chain (default 1)\n");
+   (void) fprintf(stderr, "-t [threads]     The number of threads which \
+build one route, for every chain or replica (default 1)\n");
+   (void) fprintf(stderr, "-c [candidates]  The number of rotations one sa \
+chain evaluates at once on the threads (default 1)\n");
+   (void) fprintf(stderr, "-x [cities]      Cells with at most this many \
+cities are solved exactly, at most %d (default %d)\n", LEAF_MAX, LEAF_CITIES);
+   (void) fprintf(stderr, "-d [levels]      The number of levels which sa \
+leaves out at the begin temperature, one less as it cools (default 0)\n");
+   (void) fprintf(stderr, "-a [entries]     Only with -x 1 or less, as the \
+grid does not determine the path through a leaf: the number of routes every \
+context caches by the signature of its grid (default 0)\n");
+   (void) fprintf(stderr, "-r [seed]        The seed of the first chain or \
+replica, chain i uses seed + i (default 0)\n");
+   (void) fprintf(stderr, "-m [mode]        sa for thermodynamic annealing, \
+pt for parallel tempering, scan to sample the grids of the circle from one \
+change to the next, only with -x 1 or less, sweep to evaluate evenly spaced \
+rotations, tiled to solve the file tile by tile \
+(default sa)\n");
+   (void) fprintf(stderr, "-p [replicas]    The number of replicas of the \
+parallel tempering (default 8)\n");
+   (void) fprintf(stderr, "-n [rounds]      The number of exchanges of the \
+parallel tempering (default 1000)\n");
+   (void) fprintf(stderr, "-w [angles]      The number of rotations of the \
+sweep (default 1000)\n");
+   (void) fprintf(stderr, "-g [starts]      The number of best rotations of \
+the sweep which start an sa chain, none to stop after the sweep \
+(default 0)\n");
+   (void) fprintf(stderr, "-o [tour file]   The filename where the tour of \
+the tiled mode is written, only allowed with -m tiled (default standard \
+output)\n");
+   (void) fprintf(stderr, "-z [cities]      The average number of cities of \
+a tile in the tiled mode (default %d)\n", TILE_CITIES);
    (void) fprintf(stderr, "\n");
    (void) fprintf(stderr, "Travelling salesman solver version %s.\n", VERSION);
    (void) fprintf(stderr, "Report bugs to %s.\n", PACKAGE_BUGREPORT);
@@ -19,9 +19,13 @@ typedef struct
    } distance_type;
 
    City   *cities;
+   /* The coordinates of the cities as separate arrays. */
+   double *x;
+   double *y;
    int    *tour;
 } Tsp;
 
-extern Tsp *tsp;
+/* The state of one solver, see context.h. */
+typedef struct context Context;
 
 #endif
@@ -0,0 +1,105 @@
+#include <err.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <sysexits.h>
+#include <assert.h>
+
+#include "workspace.h"
+
+/* Every buffer starts at a cache line. */
+#define ARENA_ALIGN 64
+
+static size_t arena_size(size_t size);
+static void *arena_take(char **arena, size_t size);
+
+Workspace *
+create_workspace(const Tsp * tsp)
+{
+   Workspace *ws;
+   size_t  n;
+   size_t  size;
+   char   *arena;
+
+   assert(tsp != NULL);
+   assert(tsp->dimension > 0);
+
+   if ((ws = calloc(1, sizeof(Workspace))) == NULL)
+      errx(EX_OSERR, "Not enough memory!");
+
+   n = tsp->dimension;
+   ws->num_cities = tsp->dimension;
+   ws->max_blocks = tsp->dimension / 2 + 1;
+   ws->max_parts = (ws->max_blocks + PART_BLOCKS - 1) / PART_BLOCKS;
+   ws->stamp = 0;
+
+   /*
+    * Compute the size of the arena, so it can be allocated at once. 
+    */
+   size = 2 * arena_size(n * sizeof(double)) +
+       2 * arena_size(n * sizeof(uint64_t)) +
+       2 * arena_size(n * sizeof(int)) +
+       2 * arena_size(ws->max_blocks * sizeof(uint16_t)) +
+       6 * arena_size(ws->max_blocks * sizeof(int)) +
+       arena_size(ws->max_parts * sizeof(Part)) +
+       arena_size(n * sizeof(int)) +
+       arena_size(n * sizeof(unsigned int)) + 
+       arena_size(n * sizeof(int));
+
+   if ((ws->arena = calloc(1, size + ARENA_ALIGN)) == NULL)
+      errx(EX_OSERR, "Not enough memory!");
+
+   /*
+    * Align the first buffer, the others follow from arena_size(). 
+    */
+   arena = ws->arena + (ARENA_ALIGN - (uintptr_t) ws->arena % ARENA_ALIGN);
+
+   ws->rot_x = arena_take(&arena, n * sizeof(double));
+   ws->rot_y = arena_take(&arena, n * sizeof(double));
+   ws->keys = arena_take(&arena, n * sizeof(uint64_t));
+   ws->tmp_keys = arena_take(&arena, n * sizeof(uint64_t));
+   ws->order = arena_take(&arena, n * sizeof(int));
+   ws->tmp_order = arena_take(&arena, n * sizeof(int));
+   for (int i = 0; i < 2; i++) {
+      ws->blocks[i].route =
+          arena_take(&arena, ws->max_blocks * sizeof(uint16_t));
+      ws->blocks[i].lo = arena_take(&arena, ws->max_blocks * sizeof(int));
+      ws->blocks[i].hi = arena_take(&arena, ws->max_blocks * sizeof(int));
+      ws->blocks[i].ind = arena_take(&arena, ws->max_blocks * sizeof(int));
+   }
+   ws->parts = arena_take(&arena, ws->max_parts * sizeof(Part));
+   ws->ends = arena_take(&arena, n * sizeof(int));
+   ws->ends_stamp = arena_take(&arena, n * sizeof(unsigned int));
+   ws->route = arena_take(&arena, n * sizeof(int));
+
+   return ws;
+}
+
+void
+free_workspace(Workspace * ws)
+{
+   assert(ws != NULL);
+
+   free(ws->arena);
+   free(ws);
+}
+
+/*
+ * The size a buffer of size bytes takes in the arena.
+ */
+static size_t
+arena_size(size_t size)
+{
+   return (size + ARENA_ALIGN - 1) / ARENA_ALIGN * ARENA_ALIGN;
+}
+
+/*
+ * Take a buffer of size bytes from the arena.
+ */
+static void *
+arena_take(char **arena, size_t size)
+{
+   void   *buffer = *arena;
+
+   *arena += arena_size(size);
+   return buffer;
+}
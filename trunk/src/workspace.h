@@ -0,0 +1,56 @@
+#ifndef WORKSPACE_H
+#define WORKSPACE_H
+
+#include <stdint.h>
+
+#include "tsp.h"
+#include "renormalization.h"
+
+/*
+ * All the memory which is needed to renormalize a tsp. The workspace is
+ * sized once from the number of cities and carved out of one arena, so the
+ * renormalization itself never allocates memory.
+ */
+typedef struct
+{
+   int     num_cities;
+
+   /* The rotated cities, see block.c. */
+   double *rot_x;
+   double *rot_y;
+   /* The sorted keys of the rotated cities and their cities. */
+   uint64_t *keys;
+   int    *order;
+   /* Buffers for sorting the keys. */
+   uint64_t *tmp_keys;
+   int    *tmp_order;
+
+   /*
+    * The blocks of two successive levels, see renormalization.c. Every block
+    * which is refined holds at least two cities, so a level never has more
+    * than max_blocks blocks.
+    */
+   Blocks  blocks[2];
+   int     max_blocks;
+   /* The parts in which the blocks of a level are expanded. */
+   Part   *parts;
+   int     max_parts;
+
+   /* The cities at the ends of the pieces of the route and their stamps. */
+   int    *ends;
+   unsigned int *ends_stamp;
+   unsigned int stamp;
+
+   /* The route which is built by renormalize(). */
+   int    *route;
+
+   /* The arena from which all the buffers are taken. */
+   char   *arena;
+} Workspace;
+
+/* Create a workspace for the cities of tsp. */
+Workspace *create_workspace(const Tsp * tsp);
+/* Free a workspace object. */
+void    free_workspace(Workspace * ws);
+
+#endif /* WORKSPACE_H */